@@ -0,0 +1,24 @@
+-- Insertion and selection of :rows records
+\timing on
+\echo pgv_load() of records
+SELECT pgv_load('bench', 'r1',
+	'SELECT i, md5(i::text) FROM generate_series(1, ' || :rows || ') i');
+\echo pgv_insert() of records
+SELECT count(pgv_insert('bench', 'r2', row(i, md5(i::text))))
+	FROM generate_series(1, :rows) i;
+\echo pgv_select() by key
+SELECT count(pgv_select('bench', 'r1', i)) FROM generate_series(1, :rows) i;
+\echo pgv_select() by array of keys
+SELECT count(*) FROM pgv_select('bench', 'r1',
+	(SELECT array_agg(i) FROM generate_series(1, :rows) i)) AS (id int, t text);
+\echo pgv_select() of all records
+SELECT count(*) FROM pgv_select('bench', 'r1') AS (id int, t text);
+\echo pgv_select_ordered() of all records
+SELECT count(*) FROM pgv_select_ordered('bench', 'r1') AS (id int, t text);
+\timing off
+\echo Memory per record in bytes
+SELECT allocated_memory / (2 * :rows) AS bytes_per_record
+	FROM pgv_stats() WHERE package = 'bench';
+SELECT name, records, data_size / records AS data_bytes_per_record
+	FROM pgv_stats_detailed() WHERE package = 'bench' ORDER BY name;
+SELECT pgv_remove('bench');
@@ -0,0 +1,87 @@
+#!/usr/bin/env bash
+
+#
+# Copyright (c) 2018, Postgres Professional
+#
+# Benchmarks of pg_variables. The extension should be installed into the
+# server given by the usual libpq environment variables (PGHOST, PGPORT,
+# PGDATABASE and so on).
+#
+# settings:
+#		* BENCH_LOOPS    - calls of a function per statement (1000000)
+#		* BENCH_ROWS     - numbers of records (1000 100000 10000000)
+#		* BENCH_CLIENTS  - numbers of clients of pgbench (1 4)
+#		* BENCH_TIME     - duration of each run of pgbench in seconds (10)
+#		* BENCH_BASELINE - summary to compare with (bench/baseline.txt)
+#
+# The full output is written into bench/results/, the summary is printed and
+# compared with the baseline if it exists. To save new baseline numbers copy
+# the summary into bench/baseline.txt.
+#
+
+set -eu
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+BENCH_LOOPS=${BENCH_LOOPS:-1000000}
+BENCH_ROWS=${BENCH_ROWS:-"1000 100000 10000000"}
+BENCH_CLIENTS=${BENCH_CLIENTS:-"1 4"}
+BENCH_TIME=${BENCH_TIME:-10}
+BENCH_BASELINE=${BENCH_BASELINE:-$BENCH_DIR/baseline.txt}
+
+RESULTS=$BENCH_DIR/results/$(date +%Y%m%d-%H%M%S)
+mkdir -p "$RESULTS"
+
+PSQL="psql -X -q -v ON_ERROR_STOP=1"
+
+# print "name<TAB>time in ms" for each statement preceded by \echo label
+summarize_psql()
+{
+	awk -v prefix="$1" '
+		/^Time: / { if (label != "") printf "%s: %s\t%s\tms\n", prefix, label, $2; label = ""; next }
+		/^[^ (-]/ { label = $0 }
+	' "$2"
+}
+
+$PSQL -c "CREATE EXTENSION IF NOT EXISTS pg_variables"
+$PSQL -c "SELECT version()" > "$RESULTS/version.txt"
+
+$PSQL -v loops="$BENCH_LOOPS" -f "$BENCH_DIR/scalars.sql" > "$RESULTS/scalars.txt"
+summarize_psql "scalars loops=$BENCH_LOOPS" "$RESULTS/scalars.txt" >> "$RESULTS/summary.txt"
+
+for rows in $BENCH_ROWS; do
+	$PSQL -v rows="$rows" -f "$BENCH_DIR/records.sql" > "$RESULTS/records-$rows.txt"
+	summarize_psql "records rows=$rows" "$RESULTS/records-$rows.txt" >> "$RESULTS/summary.txt"
+	awk -v prefix="records rows=$rows" '
+		/bytes_per_record/ { getline; getline; printf "%s: allocated memory per record\t%s\tbytes\n", prefix, $1 }
+	' "$RESULTS/records-$rows.txt" >> "$RESULTS/summary.txt"
+done
+
+$PSQL -v loops=$((BENCH_LOOPS / 10)) -f "$BENCH_DIR/savepoints.sql" > "$RESULTS/savepoints.txt"
+summarize_psql "savepoints loops=$((BENCH_LOOPS / 10))" "$RESULTS/savepoints.txt" >> "$RESULTS/summary.txt"
+
+for script in scalar transactional; do
+	for clients in $BENCH_CLIENTS; do
+		out="$RESULTS/$script-$clients.txt"
+		pgbench -n -M prepared -c "$clients" -j "$clients" -T "$BENCH_TIME" \
+			-f "$BENCH_DIR/$script.pgbench" > "$out"
+		awk -v prefix="pgbench $script clients=$clients" '
+			/^tps = / { printf "%s: tps\t%s\ttps\n", prefix, $3; exit }
+		' "$out" >> "$RESULTS/summary.txt"
+	done
+done
+
+echo "Results are written into $RESULTS"
+if [ -f "$BENCH_BASELINE" ]; then
+	# print baseline and current values with their ratio
+	awk -F '\t' '
+		NR == FNR { base[$1] = $2; next }
+		{
+			if ($1 in base && base[$1] > 0)
+				printf "%-70s %12s %12s %8.2f\n", $1, base[$1], $2, $2 / base[$1]
+			else
+				printf "%-70s %12s %12s\n", $1, "-", $2
+		}
+	' "$BENCH_BASELINE" "$RESULTS/summary.txt"
+else
+	cat "$RESULTS/summary.txt"
+fi
@@ -0,0 +1,37 @@
+-- PL/pgSQL loops with subtransactions changing transactional variables
+SELECT set_config('bench.loops', :'loops', false);
+SELECT pgv_load('bench', 'trans_r1',
+	'SELECT i, md5(i::text) FROM generate_series(1, 10000) i', true);
+\timing on
+\echo Subtransactions changing a scalar variable
+DO $$
+BEGIN
+	FOR i IN 1 .. current_setting('bench.loops')::int LOOP
+		BEGIN
+			PERFORM pgv_set('bench', 'trans1', i, true);
+			IF i % 2 = 0 THEN
+				RAISE EXCEPTION 'rollback';
+			END IF;
+		EXCEPTION WHEN raise_exception THEN
+			NULL;
+		END;
+	END LOOP;
+END
+$$;
+\echo Subtransactions changing records
+DO $$
+BEGIN
+	FOR i IN 1 .. current_setting('bench.loops')::int LOOP
+		BEGIN
+			PERFORM pgv_update('bench', 'trans_r1', row(i % 10000 + 1, 'changed'::text));
+			IF i % 2 = 0 THEN
+				RAISE EXCEPTION 'rollback';
+			END IF;
+		EXCEPTION WHEN raise_exception THEN
+			NULL;
+		END;
+	END LOOP;
+END
+$$;
+\timing off
+SELECT pgv_remove('bench');
@@ -0,0 +1,16 @@
+-- Calls of scalar functions within one query, :loops calls per statement
+SELECT pgv_set('bench', 'int1', 101);
+SELECT pgv_set('bench', 'text1', 'text value'::text);
+\timing on
+\echo pgv_set() of integer
+SELECT count(pgv_set('bench', 'int1', i)) FROM generate_series(1, :loops) i;
+\echo pgv_get() of integer
+SELECT count(pgv_get('bench', 'int1', NULL::int)) FROM generate_series(1, :loops) i;
+\echo pgv_get() of text
+SELECT count(pgv_get('bench', 'text1', NULL::text)) FROM generate_series(1, :loops) i;
+\echo pgv_set() of variables with different names
+SELECT count(pgv_set('bench', 'int' || (i % 1000), i)) FROM generate_series(1, :loops) i;
+\echo pgv_get() of variables with different names
+SELECT count(pgv_get('bench', 'int' || (i % 1000), NULL::int)) FROM generate_series(1, :loops) i;
+\timing off
+SELECT pgv_remove('bench');
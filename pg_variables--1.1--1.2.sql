@@ -0,0 +1,272 @@
+/* contrib/pg_variables/pg_variables--1.1--1.2.sql */
+
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION pg_variables UPDATE TO '1.2'" to load this file. \quit
+
+-- Functions to work with records
+CREATE FUNCTION pgv_load(package text, name text, query text, is_transactional bool default false)
+RETURNS bigint
+AS 'MODULE_PATHNAME', 'variable_load'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_compact(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_compact'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_ordered(package text, name text)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_ordered'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_range(package text, name text, lo anynonarray, hi anynonarray)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_range'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_le(package text, name text, value anynonarray)
+RETURNS record
+AS 'MODULE_PATHNAME', 'variable_select_le'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_create_index(package text, name text, column_name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_create_index'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_by(package text, name text, column_name text, value anynonarray)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_by'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_select_ordinality(package text, name text, value anyarray)
+RETURNS setof record
+AS 'MODULE_PATHNAME', 'variable_select_ordinality'
+LANGUAGE C VOLATILE;
+
+-- Foreign data wrapper to access record variables as tables
+CREATE FUNCTION pgv_fdw_handler()
+RETURNS fdw_handler
+AS 'MODULE_PATHNAME', 'pgv_fdw_handler'
+LANGUAGE C STRICT;
+
+CREATE FUNCTION pgv_fdw_validator(text[], oid)
+RETURNS void
+AS 'MODULE_PATHNAME', 'pgv_fdw_validator'
+LANGUAGE C STRICT;
+
+CREATE FOREIGN DATA WRAPPER pg_variables
+  HANDLER pgv_fdw_handler
+  VALIDATOR pgv_fdw_validator;
+
+-- Binary dumps of packages
+CREATE FUNCTION pgv_dump(package text)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'package_dump'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_restore(dump bytea)
+RETURNS void
+AS 'MODULE_PATHNAME', 'package_restore'
+LANGUAGE C VOLATILE;
+
+-- Tuples of a dump are loaded as they are, so it should come from a trusted
+-- source
+REVOKE ALL ON FUNCTION pgv_restore(bytea) FROM PUBLIC;
+
+-- Read-only records mapped from files
+CREATE FUNCTION pgv_save(package text, name text, filename text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_save'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_map(package text, name text, filename text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_map'
+LANGUAGE C VOLATILE;
+
+-- These functions access files of the server
+REVOKE ALL ON FUNCTION pgv_save(text, text, text) FROM PUBLIC;
+REVOKE ALL ON FUNCTION pgv_map(text, text, text) FROM PUBLIC;
+
+-- Scalar variables shared by all backends
+CREATE FUNCTION pgv_set_shared(package text, name text, value anynonarray)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_set_shared'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_get_shared(package text, name text, var_type anynonarray, strict bool default true)
+RETURNS anynonarray
+AS 'MODULE_PATHNAME', 'variable_get_shared'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_remove_shared(package text, name text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'remove_shared_variable'
+LANGUAGE C VOLATILE;
+
+-- Planner support function which estimates rows returned by pgv_select(),
+-- available since PostgreSQL 12
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 120000 THEN
+		CREATE FUNCTION pgv_select_support(internal)
+		RETURNS internal
+		AS 'MODULE_PATHNAME', 'variable_select_support'
+		LANGUAGE C STRICT;
+
+		ALTER FUNCTION pgv_select(text, text)
+			SUPPORT pgv_select_support;
+		ALTER FUNCTION pgv_select(text, text, anyarray)
+			SUPPORT pgv_select_support;
+		ALTER FUNCTION pgv_select_ordered(text, text)
+			SUPPORT pgv_select_support;
+		ALTER FUNCTION pgv_select_ordinality(text, text, anyarray)
+			SUPPORT pgv_select_support;
+	END IF;
+END
+$$;
+
+-- Functions which read variables of the backend can be used in parallel
+-- queries, but they are run by the leader. Shared variables can be read by
+-- parallel workers too.
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 90600 THEN
+		ALTER FUNCTION pgv_get(text, text, anynonarray, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_int(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_text(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_numeric(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_timestamp(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_timestamptz(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_date(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_jsonb(text, text, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select(text, text) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select(text, text, anynonarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select(text, text, anyarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select_ordered(text, text) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select_range(text, text, anynonarray, anynonarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select_le(text, text, anynonarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select_by(text, text, text, anynonarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_select_ordinality(text, text, anyarray) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_exists(text, text) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_exists(text) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_list() PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_stats() PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_get_shared(text, text, anynonarray, bool) PARALLEL SAFE;
+	END IF;
+END
+$$;
+
+-- Packages whose record variables evict least recently used records
+CREATE FUNCTION pgv_create_cache(package text, max_memory bigint)
+RETURNS void
+AS 'MODULE_PATHNAME', 'package_create_cache'
+LANGUAGE C VOLATILE;
+
+-- Values and records which expire after the given interval
+CREATE FUNCTION pgv_set(package text, name text, value anynonarray, is_transactional bool, ttl interval)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_set_any'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_insert(package text, name text, r record, is_transactional bool, ttl interval)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_insert'
+LANGUAGE C VOLATILE;
+
+-- Statistics of variables which don't require examination of memory contexts
+CREATE FUNCTION pgv_stats_detailed()
+RETURNS TABLE(package text, name text, is_transactional bool, records bigint, data_size bigint, states int)
+AS 'MODULE_PATHNAME', 'get_variables_stats'
+LANGUAGE C VOLATILE;
+
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 90600 THEN
+		ALTER FUNCTION pgv_stats_detailed() PARALLEL RESTRICTED;
+	END IF;
+END
+$$;
+
+-- Statistics collected when pg_variables.profile is enabled
+CREATE FUNCTION pgv_profile()
+RETURNS TABLE(name text, count bigint, total_time double precision, latency bigint[])
+AS 'MODULE_PATHNAME', 'get_profile'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_profile_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'reset_profile'
+LANGUAGE C VOLATILE;
+
+-- Array variables
+CREATE FUNCTION pgv_push(package text, name text, value anynonarray, is_transactional bool default false)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_push'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_get_elem(package text, name text, idx int, var_type anynonarray, strict bool default true)
+RETURNS anynonarray
+AS 'MODULE_PATHNAME', 'variable_get_elem'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_set_elem(package text, name text, idx int, value anynonarray)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_set_elem'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_len(package text, name text)
+RETURNS int
+AS 'MODULE_PATHNAME', 'variable_len'
+LANGUAGE C VOLATILE;
+
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 90600 THEN
+		ALTER FUNCTION pgv_get_elem(text, text, int, anynonarray, bool) PARALLEL RESTRICTED;
+		ALTER FUNCTION pgv_len(text, text) PARALLEL RESTRICTED;
+	END IF;
+END
+$$;
+
+-- Counters and conditional updates of scalar variables
+CREATE FUNCTION pgv_incr(package text, name text, delta anynonarray, is_transactional bool default false)
+RETURNS anynonarray
+AS 'MODULE_PATHNAME', 'variable_incr'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_cas(package text, name text, expected anynonarray, value anynonarray)
+RETURNS bool
+AS 'MODULE_PATHNAME', 'variable_cas'
+LANGUAGE C VOLATILE;
+
+-- Several scalar variables at once
+CREATE FUNCTION pgv_get_many(package text, names text[], var_type anynonarray, strict bool default true)
+RETURNS anyarray
+AS 'MODULE_PATHNAME', 'variable_get_many'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_set_many(package text, names text[], vals anyarray, is_transactional bool default false)
+RETURNS void
+AS 'MODULE_PATHNAME', 'variable_set_many'
+LANGUAGE C VOLATILE;
+
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::int >= 90600 THEN
+		ALTER FUNCTION pgv_get_many(text, text[], anynonarray, bool) PARALLEL RESTRICTED;
+	END IF;
+END
+$$;
+
+-- Removal of variables which keeps packages
+CREATE FUNCTION pgv_reset(package text)
+RETURNS void
+AS 'MODULE_PATHNAME', 'reset_package'
+LANGUAGE C VOLATILE;
+
+CREATE FUNCTION pgv_reset()
+RETURNS void
+AS 'MODULE_PATHNAME', 'reset_packages'
+LANGUAGE C VOLATILE;
@@ -10,16 +10,33 @@
 #include "postgres.h"
 #include "fmgr.h"
 #include "funcapi.h"
+#include "miscadmin.h"
 
+#include "access/hash.h"
 #include "access/htup_details.h"
+#if PG_VERSION_NUM >= 90600
+#include "access/parallel.h"
+#endif
 #include "access/xact.h"
 #include "catalog/pg_type.h"
+#include "executor/spi.h"
+#include "libpq/pqformat.h"
+#include "nodes/plannodes.h"
+#if PG_VERSION_NUM >= 120000
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#endif
 #include "parser/scansup.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
+#include "utils/guc.h"
+#if PG_VERSION_NUM < 100000
+#include "utils/int8.h"
+#endif
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/timestamp.h"
+#include "utils/tuplestore.h"
 #include "utils/typcache.h"
 
 #include "pg_variables.h"
@@ -27,22 +44,49 @@
 PG_MODULE_MAGIC;
 
 /* Functions to work with records */
+PG_FUNCTION_INFO_V1(variable_get_many);
+PG_FUNCTION_INFO_V1(variable_set_many);
+PG_FUNCTION_INFO_V1(variable_incr);
+PG_FUNCTION_INFO_V1(variable_cas);
+PG_FUNCTION_INFO_V1(variable_push);
+PG_FUNCTION_INFO_V1(variable_get_elem);
+PG_FUNCTION_INFO_V1(variable_set_elem);
+PG_FUNCTION_INFO_V1(variable_len);
 PG_FUNCTION_INFO_V1(variable_insert);
+PG_FUNCTION_INFO_V1(variable_load);
+PG_FUNCTION_INFO_V1(variable_compact);
+PG_FUNCTION_INFO_V1(package_dump);
+PG_FUNCTION_INFO_V1(package_restore);
+PG_FUNCTION_INFO_V1(variable_save);
+PG_FUNCTION_INFO_V1(variable_map);
 PG_FUNCTION_INFO_V1(variable_update);
 PG_FUNCTION_INFO_V1(variable_delete);
 
 PG_FUNCTION_INFO_V1(variable_select);
 PG_FUNCTION_INFO_V1(variable_select_by_value);
 PG_FUNCTION_INFO_V1(variable_select_by_values);
+PG_FUNCTION_INFO_V1(variable_select_ordinality);
+PG_FUNCTION_INFO_V1(variable_select_ordered);
+PG_FUNCTION_INFO_V1(variable_select_range);
+PG_FUNCTION_INFO_V1(variable_select_le);
+PG_FUNCTION_INFO_V1(variable_create_index);
+PG_FUNCTION_INFO_V1(variable_select_by);
+#if PG_VERSION_NUM >= 120000
+PG_FUNCTION_INFO_V1(variable_select_support);
+#endif
 
 /* Functions to work with packages */
 PG_FUNCTION_INFO_V1(variable_exists);
 PG_FUNCTION_INFO_V1(package_exists);
+PG_FUNCTION_INFO_V1(package_create_cache);
 PG_FUNCTION_INFO_V1(remove_variable);
 PG_FUNCTION_INFO_V1(remove_package);
 PG_FUNCTION_INFO_V1(remove_packages);
+PG_FUNCTION_INFO_V1(reset_package);
+PG_FUNCTION_INFO_V1(reset_packages);
 PG_FUNCTION_INFO_V1(get_packages_and_variables);
 PG_FUNCTION_INFO_V1(get_packages_stats);
+PG_FUNCTION_INFO_V1(get_variables_stats);
 
 extern void _PG_init(void);
 extern void _PG_fini(void);
@@ -54,9 +98,21 @@ static Variable *getVariableInternal(Package *package,
 									 text *name, Oid typid,
 									 bool strict);
 static Variable *createVariableInternal(Package *package,
-										text *name, Oid typid,
+										text *name, Oid typid, bool is_array,
 										bool is_transactional);
+static Variable *findVariable(Package *package, const char *key);
+static void markVariableChanged(Variable *variable, bool is_new);
 static void removePackageInternal(Package *package);
+static void resetPackageInternal(Package *package);
+static void checkMemoryLimits(Package *package);
+
+/* Functions to work with the cache of names */
+static uint32 nameCacheHash(const char *key, Package *package);
+static Package *getCachedPackage(const char *key, uint32 hash);
+static Variable *getCachedVariable(Package *package, const char *key,
+								   uint32 hash);
+static void cacheObject(uint32 hash, Package *package, Variable *variable);
+static void invalidateNameCache(Package *package, Variable *variable);
 
 /* Functions to work with transactional objects */
 static void createSavepoint(TransObject *object, TransObjectType type);
@@ -64,7 +120,8 @@ static void releaseSavepoint(TransObject *object, TransObjectType type);
 static void rollbackSavepoint(TransObject *object, TransObjectType type);
 
 static void copyValue(VarState *src, VarState *dest, Variable *destVar);
-static void freeValue(VarState *varstate, Oid typid);
+static void freeValue(VarState *varstate, Variable *variable);
+static bool isScalarValueShared(VarState *varstate, Variable *variable);
 static void removeState(TransObject *object, TransObjectType type,
 						TransState *stateToDelete);
 static void removeObject(TransObject *object, TransObjectType type);
@@ -72,53 +129,90 @@ static bool isObjectChangedInCurrentTrans(TransObject *object);
 static bool isObjectChangedInUpperTrans(TransObject *object);
 
 static void addToChangesStack(TransObject *object, TransObjectType type);
-static void pushChangesStack(void);
-static void removeFromChangedVars(Package *package);
+static ChangesStackNode *getChangesStackNode(int level);
+static bool isChangesStackLevel(void);
+static void unlinkChangedState(TransState *state);
 
 /* Constructors */
 static void makePackHTAB(Package *package, bool is_trans);
+static void createVarsHash(Package *package, bool is_trans, long nelem);
 
 
-#define CHECK_ARGS_FOR_NULL() \
-do { \
-	if (fcinfo->argnull[0]) \
-		ereport(ERROR, \
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE), \
-				 errmsg("package name can not be NULL"))); \
-	if (fcinfo->argnull[1]) \
-		ereport(ERROR, \
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE), \
-				 errmsg("variable name can not be NULL"))); \
-} while(0)
-
 static HTAB *packagesHash = NULL;
 static MemoryContext ModuleContext = NULL;
+/* States of packages, a child of ModuleContext */
+static MemoryContext packStatesContext = NULL;
+
+/* Store tuples of new record variables in dense blocks */
+bool		denseRecords = false;
+
+/* Limits of memory used by variables in kilobytes, 0 disables a limit */
+static int	maxMemoryPerBackend = 0;
+static int	maxMemoryPerPackage = 0;
+
+/* Size of values stored by all packages, see AddMemoryUsage() */
+Size		backendUsage = 0;
+
+/*
+ * Cache of recently used packages and variables. An entry is placed into the
+ * slot chosen by hash of the object's name (and of its package for
+ * variables), so the hit doesn't require probing of dynahash tables.
+ */
+#define NAME_CACHE_SIZE 64
+
+typedef struct NameCacheEntry
+{
+	uint32		hash;
+	Package    *package;
+	/* NULL for an entry of the package itself */
+	Variable   *variable;
+}			NameCacheEntry;
 
-/* Recent package */
-static Package *LastPackage = NULL;
-/* Recent variable */
-static Variable *LastVariable = NULL;
+static NameCacheEntry nameCache[NAME_CACHE_SIZE];
+
+/*
+ * Generation of the cache, it is advanced each time a package or a variable
+ * is removed. Pointers cached by call sites are valid only within the same
+ * generation.
+ */
+static uint64 nameCacheGeneration = 0;
+
+typedef struct CallSiteCache
+{
+	uint64		generation;
+	Variable   *variable;
+}			CallSiteCache;
 
 
-/* This stack contains lists of changed variables and packages per each subxact level */
+/*
+ * This stack contains lists of changed variables and packages of subxact
+ * levels, deepest level first. Only levels which changed something have
+ * an element.
+ */
 static dlist_head *changesStack = NULL;
 static MemoryContext changesStackContext = NULL;
-
-/* Returns a lists of packages and variables changed at current subxact level */
-#define get_actual_changes_list() \
-	( \
-		AssertMacro(changesStack != NULL), \
-		(dlist_head_element(ChangesStackNode, node, changesStack)) \
-	)
 #define pack_hctx(pack, is_trans) \
 			(is_trans ? pack->hctxTransact : pack->hctxRegular)
 #define pack_htab(pack, is_trans) \
 			(is_trans ? pack->varHashTransact : pack->varHashRegular)
 
+/* Header of dumps made by pgv_dump() */
+#define PGV_DUMP_MAGIC		0x50475644
+#define PGV_DUMP_VERSION	2
+
+/* Number of rows fetched at once by pgv_load() */
+#define PGV_LOAD_BATCH_SIZE	1000
+/* Upper limit of presized records hash of pgv_load() */
+#define PGV_LOAD_MAX_PRESIZE	(1 << 22)
+
 #define PGV_MCXT_MAIN		"pg_variables: main memory context"
 #define PGV_MCXT_VARS		"pg_variables: variables hash"
 #define PGV_MCXT_STACK		"pg_variables: changesStack"
-#define PGV_MCXT_STACK_NODE	"pg_variables: changesStackNode"
+#define PGV_MCXT_PACK_STATES	"pg_variables: package states"
+#define PGV_MCXT_VAR_STATES	"pg_variables: variable states"
+
+/* Size of blocks of contexts of states */
+#define PGV_STATES_BLOCK_SIZE	(4 * 1024)
 
 
 #ifndef ALLOCSET_DEFAULT_SIZES
@@ -133,68 +227,262 @@ static MemoryContext changesStackContext = NULL;
 
 
 /*
- * Set value of variable, typlen could be 0 if typbyval == true
+ * Check that the name passed to a function is the name of the object.
+ */
+static bool
+isNameOf(text *name, const char *key)
+{
+	int			len = VARSIZE_ANY_EXHDR(name);
+
+	return strncmp(VARDATA_ANY(name), key, len) == 0 && key[len] == '\0';
+}
+
+/*
+ * Return a variable resolved by previous call of the function, if no variable
+ * was removed since that call. Names are compared with names of the cached
+ * variable, since arguments which are stable within a call site, such as
+ * parameters of PL/pgSQL expressions, can change between calls.
+ */
+static Variable *
+getCallSiteVariable(FmgrInfo *flinfo, text *package_name, text *var_name)
+{
+	CallSiteCache *cache = (CallSiteCache *) flinfo->fn_extra;
+
+	if (cache != NULL && cache->generation == nameCacheGeneration &&
+		isNameOf(var_name, GetName(cache->variable)) &&
+		isNameOf(package_name, GetName(cache->variable->package)))
+	{
+		PROFILE_COUNT(PROFILE_CALL_SITE_HITS, 1);
+		return cache->variable;
+	}
+
+	return NULL;
+}
+
+/*
+ * Remember a resolved variable in fn_extra if names are stable.
  */
 static void
-variable_set(text *package_name, text *var_name,
-			 Oid typid, Datum value, bool is_null, bool is_transactional)
+setCallSiteVariable(FmgrInfo *flinfo, Variable *variable)
 {
-	Package	   *package;
-	Variable   *variable;
-	ScalarVar  *scalar;
+	CallSiteCache *cache;
 
-	package = getPackageByName(package_name, true, false);
-	variable = createVariableInternal(package, var_name, typid,
-									  is_transactional);
+	if (!get_fn_expr_arg_stable(flinfo, 0) ||
+		!get_fn_expr_arg_stable(flinfo, 1))
+		return;
 
-	scalar = &(GetActualValue(variable).scalar);
+	if (flinfo->fn_extra == NULL)
+		flinfo->fn_extra = MemoryContextAlloc(flinfo->fn_mcxt,
+											  sizeof(CallSiteCache));
+
+	cache = (CallSiteCache *) flinfo->fn_extra;
+	cache->generation = nameCacheGeneration;
+	cache->variable = variable;
+}
+
+/*
+ * Store a copy of the value into the actual state of a scalar variable
+ * prepared by markVariableChanged().
+ */
+static void
+setScalarValue(Variable *variable, Datum value, bool is_null)
+{
+	ScalarVar  *scalar = &(GetActualValue(variable).scalar);
+	Size	   *usage = GetPackageUsage(variable->package,
+										variable->is_transactional);
+	bool		shared = false;
 
-	/* Release memory for variable */
+	/* Release memory for variable unless previous state still uses it */
 	if (scalar->typbyval == false && scalar->is_null == false)
-		pfree(DatumGetPointer(scalar->value));
+	{
+		shared = isScalarValueShared((VarState *) GetActualState(variable),
+									 variable);
+		if (!shared)
+		{
+			SubMemoryUsage(usage, datumGetSize(scalar->value, false,
+											   scalar->typlen));
+			pfree(DatumGetPointer(scalar->value));
+		}
+	}
 
 	scalar->is_null = is_null;
+	scalar->expires = 0;
 	if (!scalar->is_null)
 	{
 		MemoryContext oldcxt;
 
-		oldcxt = MemoryContextSwitchTo(pack_hctx(package, is_transactional));
+		/*
+		 * Store a plain value, not a toast pointer or a compressed value.
+		 * pgv_get() returns the stored value as is, so it is fetched or
+		 * decompressed only once instead of each access.
+		 */
+		if (scalar->typlen == -1)
+			value = PointerGetDatum(PG_DETOAST_DATUM(value));
+
+		oldcxt = MemoryContextSwitchTo(pack_hctx(variable->package,
+												 variable->is_transactional));
 		scalar->value = datumCopy(value, scalar->typbyval, scalar->typlen);
 		MemoryContextSwitchTo(oldcxt);
+
+		if (!scalar->typbyval)
+			AddMemoryUsage(usage, datumGetSize(scalar->value, false,
+											   scalar->typlen));
+
+		/* The previous value is kept by the savepoint */
+		if (shared)
+			PROFILE_COUNT(PROFILE_SAVEPOINT_BYTES,
+						  datumGetSize(scalar->value, false, scalar->typlen));
 	}
 	else
 		scalar->value = 0;
 }
 
-static Datum
-variable_get(text *package_name, text *var_name,
-			 Oid typid, bool *is_null, bool strict)
+/*
+ * Get expiration time of a value from the time-to-live argument. Returns 0 if
+ * the argument is NULL, which means that the value never expires.
+ */
+static TimestampTz
+getExpirationTime(FunctionCallInfo fcinfo, int argno)
+{
+	TimestampTz now;
+	TimestampTz expires;
+
+	if (PG_ARGISNULL(argno))
+		return 0;
+
+	now = GetCurrentTimestamp();
+	expires = DatumGetTimestampTz(DirectFunctionCall2(timestamptz_pl_interval,
+													  TimestampTzGetDatum(now),
+													  PG_GETARG_DATUM(argno)));
+	if (expires <= now)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("time-to-live should be positive")));
+
+	return expires;
+}
+
+/*
+ * Set value of variable, typlen could be 0 if typbyval == true. Value expires
+ * at 'expires' unless it is 0.
+ */
+static void
+variable_set(FmgrInfo *flinfo, text *package_name, text *var_name,
+			 Oid typid, Datum value, bool is_null, bool is_transactional,
+			 TimestampTz expires)
 {
 	Package	   *package;
 	Variable   *variable;
-	ScalarVar  *scalar;
 
-	package = getPackageByName(package_name, false, strict);
-	if (package == NULL)
+	variable = getCallSiteVariable(flinfo, package_name, var_name);
+	if (variable != NULL && variable->typid == typid &&
+		variable->is_transactional == is_transactional)
 	{
-		*is_null = true;
-		return 0;
+		checkMemoryLimits(variable->package);
+		markVariableChanged(variable, false);
+	}
+	else
+	{
+		package = getPackageByName(package_name, true, false);
+		checkMemoryLimits(package);
+		variable = createVariableInternal(package, var_name, typid, false,
+										  is_transactional);
+		setCallSiteVariable(flinfo, variable);
 	}
 
-	variable = getVariableInternal(package, var_name, typid, strict);
+	setScalarValue(variable, value, is_null);
+	GetActualValue(variable).scalar.expires = expires;
+}
+
+/*
+ * Check that the value of the scalar variable has expired.
+ */
+static bool
+isScalarValueExpired(ScalarVar *scalar)
+{
+	return scalar->expires != 0 && scalar->expires <= GetCurrentTimestamp();
+}
+
+/*
+ * Check that the variable is seen by the user: it isn't removed and it isn't
+ * a scalar variable whose value has expired.
+ */
+static bool
+isVariableVisible(Variable *variable)
+{
+	if (!GetActualState(variable)->is_valid)
+		return false;
+	if (variable->typid == RECORDOID || variable->is_array)
+		return true;
+
+	return !isScalarValueExpired(&(GetActualValue(variable).scalar));
+}
+
+/*
+ * Return the value of the scalar variable. Expired value is treated as
+ * missing and released.
+ */
+static Datum
+getScalarValue(Variable *variable, bool strict, bool *is_null)
+{
+	ScalarVar  *scalar = &(GetActualValue(variable).scalar);
 
-	if (variable == NULL)
+	if (isScalarValueExpired(scalar))
 	{
-		*is_null = true;
-		return 0;
+		if (strict)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unrecognized variable \"%s\"", GetName(variable))));
+
+		if (scalar->typbyval == false && scalar->is_null == false &&
+			!isScalarValueShared((VarState *) GetActualState(variable),
+								 variable))
+		{
+			SubMemoryUsage(GetPackageUsage(variable->package,
+										   variable->is_transactional),
+						   datumGetSize(scalar->value, false, scalar->typlen));
+			pfree(DatumGetPointer(scalar->value));
+		}
+		scalar->is_null = true;
+		scalar->value = 0;
 	}
 
-	scalar = &(GetActualValue(variable).scalar);
 	*is_null = scalar->is_null;
 
 	return scalar->value;
 }
 
+static Datum
+variable_get(FmgrInfo *flinfo, text *package_name, text *var_name,
+			 Oid typid, bool *is_null, bool strict)
+{
+	Package	   *package;
+	Variable   *variable;
+
+	variable = getCallSiteVariable(flinfo, package_name, var_name);
+	if (variable == NULL || variable->typid != typid ||
+		!GetActualState(variable)->is_valid)
+	{
+		package = getPackageByName(package_name, false, strict);
+		if (package == NULL)
+		{
+			*is_null = true;
+			return 0;
+		}
+
+		variable = getVariableInternal(package, var_name, typid, strict);
+
+		if (variable == NULL)
+		{
+			*is_null = true;
+			return 0;
+		}
+		setCallSiteVariable(flinfo, variable);
+	}
+
+	return getScalarValue(variable, strict, is_null);
+}
+
 
 #define VARIABLE_GET_TEMPLATE(pkg_arg, var_arg, strict_arg, type, typid) \
 	PG_FUNCTION_INFO_V1(variable_get_##type); \
@@ -206,15 +494,18 @@ variable_get(text *package_name, text *var_name,
 		bool		strict; \
 		bool		isnull; \
 		Datum		value; \
+		instr_time	call_start; \
 		\
 		CHECK_ARGS_FOR_NULL(); \
+		PROFILE_START(call_start); \
 		\
 		package_name = PG_GETARG_TEXT_PP(pkg_arg); \
 		var_name = PG_GETARG_TEXT_PP(var_arg); \
 		strict = PG_GETARG_BOOL(strict_arg); \
 		\
-		value = variable_get(package_name, var_name, \
+		value = variable_get(fcinfo->flinfo, package_name, var_name, \
 							 (typid), &isnull, strict); \
+		PROFILE_END(PROFILE_GET, call_start); \
 		\
 		PG_FREE_IF_COPY(package_name, pkg_arg); \
 		PG_FREE_IF_COPY(var_name, var_arg); \
@@ -246,16 +537,20 @@ VARIABLE_GET_TEMPLATE(0, 1, 3, any, get_fn_expr_argtype(fcinfo->flinfo, 2))
 		text	   *package_name; \
 		text	   *var_name; \
 		bool		is_transactional; \
+		instr_time	call_start; \
 		\
 		CHECK_ARGS_FOR_NULL(); \
+		PROFILE_START(call_start); \
 		\
 		package_name = PG_GETARG_TEXT_PP(0); \
 		var_name = PG_GETARG_TEXT_PP(1); \
 		is_transactional = PG_GETARG_BOOL(3); \
 		\
-		variable_set(package_name, var_name, (typid), \
+		variable_set(fcinfo->flinfo, package_name, var_name, (typid), \
 					 PG_ARGISNULL(2) ? 0 : PG_GETARG_DATUM(2), \
-					 PG_ARGISNULL(2), is_transactional); \
+					 PG_ARGISNULL(2), is_transactional, \
+					 PG_NARGS() > 4 ? getExpirationTime(fcinfo, 4) : 0); \
+		PROFILE_END(PROFILE_SET, call_start); \
 		\
 		PG_FREE_IF_COPY(package_name, 0); \
 		PG_FREE_IF_COPY(var_name, 1); \
@@ -276,162 +571,1063 @@ VARIABLE_SET_TEMPLATE(jsonb, JSONBOID)
 VARIABLE_SET_TEMPLATE(any, get_fn_expr_argtype(fcinfo->flinfo, 2))
 
 
-Datum
-variable_insert(PG_FUNCTION_ARGS)
+/*
+ * Get the array of names of variables, NULL names aren't allowed.
+ */
+static void
+getNamesArray(ArrayType *names, Datum **items, int *nitems)
 {
-	text	   *package_name;
-	text	   *var_name;
-	HeapTupleHeader rec;
-	Package	   *package;
-	Variable   *variable;
-	bool		is_transactional;
+	bool	   *nulls;
+	int			i;
 
-	Oid			tupType;
-	int32		tupTypmod;
-	TupleDesc	tupdesc;
-	RecordVar  *record;
+	if (ARR_NDIM(names) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("multidimensional arrays of names are not supported")));
 
-	/* Checks */
-	CHECK_ARGS_FOR_NULL();
+	deconstruct_array(names, TEXTOID, -1, false, 'i', items, &nulls, nitems);
+	for (i = 0; i < *nitems; i++)
+		if (nulls[i])
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("variable name can not be NULL")));
+	pfree(nulls);
+}
 
-	if (PG_ARGISNULL(2))
-		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("record argument can not be NULL")));
+/*
+ * Get values of scalar variables of the same type from the package at once.
+ * Returns the array of values in the order of the names, missing variables
+ * give NULL elements unless 'strict' is true.
+ */
+Datum
+variable_get_many(PG_FUNCTION_ARGS)
+{
+	Oid			typid;
+	bool		strict;
+	Package    *package;
+	Datum	   *names;
+	int			nnames;
+	Datum	   *values;
+	bool	   *nulls;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	int			dims[1];
+	int			lbs[1];
+	int			i;
 
-	/* Get arguments */
-	package_name = PG_GETARG_TEXT_PP(0);
-	var_name = PG_GETARG_TEXT_PP(1);
-	rec = PG_GETARG_HEAPTUPLEHEADER(2);
-	is_transactional = PG_GETARG_BOOL(3);
+	CHECK_ARGS_FOR_NULL();
 
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0)
-	{
-		package = getPackageByName(package_name, true, false);
-		LastPackage = package;
-		LastVariable = NULL;
-	}
-	else
-		package = LastPackage;
+	typid = get_fn_expr_argtype(fcinfo->flinfo, 2);
+	strict = PG_GETARG_BOOL(3);
 
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
-	{
-		variable = createVariableInternal(package, var_name, RECORDOID,
-										  is_transactional);
-		LastVariable = variable;
-	}
-	else
-	{
-		TransObject *transObj;
+	getNamesArray(PG_GETARG_ARRAYTYPE_P(1), &names, &nnames);
+	if (nnames == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(typid));
 
-		if (LastVariable->is_transactional != is_transactional)
-		{
-			char		key[NAMEDATALEN];
+	package = getPackageByName(PG_GETARG_TEXT_PP(0), false, strict);
 
-			getKeyFromName(var_name, key);
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					 errmsg("variable \"%s\" already created as %sTRANSACTIONAL",
-							key, LastVariable->is_transactional ? "" : "NOT ")));
-		}
+	values = (Datum *) palloc(nnames * sizeof(Datum));
+	nulls = (bool *) palloc(nnames * sizeof(bool));
+	for (i = 0; i < nnames; i++)
+	{
+		Variable   *variable = NULL;
 
-		variable = LastVariable;
-		transObj = &variable->transObject;
+		if (package != NULL)
+			variable = getVariableInternal(package, DatumGetTextPP(names[i]),
+										   typid, strict);
 
-		if (variable->is_transactional &&
-			!isObjectChangedInCurrentTrans(transObj))
+		if (variable == NULL || !GetActualState(variable)->is_valid)
 		{
-			createSavepoint(transObj, TRANS_VARIABLE);
-			addToChangesStack(transObj, TRANS_VARIABLE);
+			values[i] = (Datum) 0;
+			nulls[i] = true;
 		}
+		else
+			values[i] = getScalarValue(variable, strict, &nulls[i]);
 	}
 
-	/* Insert a record */
-	tupType = HeapTupleHeaderGetTypeId(rec);
-	tupTypmod = HeapTupleHeaderGetTypMod(rec);
-	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+	get_typlenbyvalalign(typid, &typlen, &typbyval, &typalign);
+	dims[0] = nnames;
+	lbs[0] = 1;
 
-	record = &(GetActualValue(variable).record);
-	if (!record->tupdesc)
-	{
-		/*
-		 * This is the first record for the var_name. Initialize record.
-		 */
-		init_record(record, tupdesc, variable);
-	}
-	else
-		check_attributes(variable, tupdesc);
+	PG_RETURN_ARRAYTYPE_P(construct_md_array(values, nulls, 1, dims, lbs,
+											 typid, typlen, typbyval,
+											 typalign));
+}
+
+/*
+ * Set scalar variables of the package to the elements of the array at once,
+ * create the package and the variables if they don't exist. Memory limits
+ * are checked once before the values are set.
+ */
+Datum
+variable_set_many(PG_FUNCTION_ARGS)
+{
+	ArrayType  *array;
+	Oid			typid;
+	bool		is_transactional;
+	Package    *package;
+	Datum	   *names;
+	int			nnames;
+	Datum	   *values;
+	bool	   *nulls;
+	int			nvalues;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	int			i;
 
-	insert_record(variable, rec);
+	CHECK_ARGS_FOR_NULL();
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("array argument can not be NULL")));
 
-	/* Release resources */
-	ReleaseTupleDesc(tupdesc);
+	array = PG_GETARG_ARRAYTYPE_P(2);
+	if (ARR_NDIM(array) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("multidimensional arrays of values are not supported")));
+	is_transactional = PG_GETARG_BOOL(3);
 
-	PG_FREE_IF_COPY(package_name, 0);
-	PG_FREE_IF_COPY(var_name, 1);
+	getNamesArray(PG_GETARG_ARRAYTYPE_P(1), &names, &nnames);
+
+	typid = ARR_ELEMTYPE(array);
+	get_typlenbyvalalign(typid, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, typid, typlen, typbyval, typalign,
+					  &values, &nulls, &nvalues);
+
+	if (nnames != nvalues)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("numbers of names and values do not match")));
+	if (nnames == 0)
+		PG_RETURN_VOID();
+
+	package = getPackageByName(PG_GETARG_TEXT_PP(0), true, false);
+	checkMemoryLimits(package);
+
+	for (i = 0; i < nnames; i++)
+	{
+		Variable   *variable;
+
+		variable = createVariableInternal(package, DatumGetTextPP(names[i]),
+										  typid, false, is_transactional);
+		setScalarValue(variable, values[i], nulls[i]);
+	}
 
 	PG_RETURN_VOID();
 }
 
+/*
+ * Add the delta to the value of int4, int8 or numeric variable and return the
+ * result. The variable is created with the value of the delta if it doesn't
+ * exist or its value has expired, a NULL value remains NULL. The value keeps
+ * its expiration time.
+ */
 Datum
-variable_update(PG_FUNCTION_ARGS)
+variable_incr(PG_FUNCTION_ARGS)
 {
-	text	   *package_name;
-	text	   *var_name;
-	HeapTupleHeader rec;
-	Package	   *package;
+	Oid			typid;
+	bool		is_transactional;
+	PGFunction	addfunc;
+	Package    *package = NULL;
 	Variable   *variable;
-	TransObject *transObject;
-	bool		res;
-	Oid			tupType;
-	int32		tupTypmod;
-	TupleDesc	tupdesc;
+	ScalarVar  *scalar = NULL;
+	char		key[NAMEDATALEN];
+	bool		cached;
+	TimestampTz expires = 0;
+	Datum		value;
 
-	/* Checks */
 	CHECK_ARGS_FOR_NULL();
-
 	if (PG_ARGISNULL(2))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("record argument can not be NULL")));
+				 errmsg("delta can not be NULL")));
 
-	/* Get arguments */
-	package_name = PG_GETARG_TEXT_PP(0);
-	var_name = PG_GETARG_TEXT_PP(1);
+	typid = get_fn_expr_argtype(fcinfo->flinfo, 2);
+	switch (typid)
+	{
+		case INT4OID:
+			addfunc = int4pl;
+			break;
+		case INT8OID:
+			addfunc = int8pl;
+			break;
+		case NUMERICOID:
+			addfunc = numeric_add;
+			break;
+		default:
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("variable of type %s can not be incremented",
+							format_type_be(typid))));
+			addfunc = NULL;		/* keep compiler quiet */
+	}
+	is_transactional = PG_GETARG_BOOL(3);
+
+	variable = getCallSiteVariable(fcinfo->flinfo, PG_GETARG_TEXT_PP(0),
+								   PG_GETARG_TEXT_PP(1));
+	cached = variable != NULL && variable->typid == typid &&
+		variable->is_transactional == is_transactional;
+	if (!cached)
+	{
+		/* Neither the package nor the variable is created yet */
+		package = getPackageByName(PG_GETARG_TEXT_PP(0), false, false);
+		getKeyFromName(PG_GETARG_TEXT_PP(1), key);
+		variable = package != NULL ? findVariable(package, key) : NULL;
+	}
+
+	/*
+	 * Compute the new value before the variable is changed. A NULL value is
+	 * returned as is, so the variable isn't changed at all, as by pgv_cas().
+	 */
+	if (variable != NULL && variable->typid == typid &&
+		variable->is_transactional == is_transactional &&
+		GetActualState(variable)->is_valid)
+	{
+		scalar = &(GetActualValue(variable).scalar);
+		if (isScalarValueExpired(scalar))
+			scalar = NULL;
+		else if (scalar->is_null)
+			PG_RETURN_NULL();
+	}
+
+	if (scalar == NULL)
+		value = PG_GETARG_DATUM(2);
+	else
+	{
+		value = DirectFunctionCall2(addfunc, scalar->value,
+									PG_GETARG_DATUM(2));
+		expires = scalar->expires;
+	}
+
+	if (cached)
+	{
+		checkMemoryLimits(variable->package);
+		markVariableChanged(variable, false);
+	}
+	else
+	{
+		if (package == NULL)
+			package = getPackageByName(PG_GETARG_TEXT_PP(0), true, false);
+		checkMemoryLimits(package);
+		variable = createVariableInternal(package, PG_GETARG_TEXT_PP(1),
+										  typid, false, is_transactional);
+		setCallSiteVariable(fcinfo->flinfo, variable);
+	}
+
+	scalar = &(GetActualValue(variable).scalar);
+	setScalarValue(variable, value, false);
+	scalar->expires = expires;
+
+	PG_RETURN_DATUM(scalar->value);
+}
+
+/*
+ * Replace the value of the variable by the new value if it is equal to the
+ * expected one. NULL values are equal to each other. Returns true if the
+ * value was replaced, the variable isn't changed otherwise.
+ */
+Datum
+variable_cas(PG_FUNCTION_ARGS)
+{
+	Oid			typid;
+	Package    *package;
+	Variable   *variable;
+	ScalarVar  *scalar;
+	TimestampTz expires;
+	bool		equal;
+
+	CHECK_ARGS_FOR_NULL();
+
+	typid = get_fn_expr_argtype(fcinfo->flinfo, 2);
+
+	variable = getCallSiteVariable(fcinfo->flinfo, PG_GETARG_TEXT_PP(0),
+								   PG_GETARG_TEXT_PP(1));
+	if (variable == NULL || variable->typid != typid ||
+		!GetActualState(variable)->is_valid)
+	{
+		package = getPackageByName(PG_GETARG_TEXT_PP(0), false, true);
+		variable = getVariableInternal(package, PG_GETARG_TEXT_PP(1), typid,
+									   true);
+		setCallSiteVariable(fcinfo->flinfo, variable);
+	}
+
+	scalar = &(GetActualValue(variable).scalar);
+	if (isScalarValueExpired(scalar))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized variable \"%s\"", GetName(variable))));
+
+	if (scalar->is_null || PG_ARGISNULL(2))
+		equal = scalar->is_null && PG_ARGISNULL(2);
+	else
+	{
+		TypeCacheEntry *typentry;
+
+		typentry = lookup_type_cache(typid, TYPECACHE_EQ_OPR_FINFO);
+		if (!OidIsValid(typentry->eq_opr_finfo.fn_oid))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an equality operator for type %s",
+							format_type_be(typid))));
+
+		equal = DatumGetBool(FunctionCall2Coll(&typentry->eq_opr_finfo,
+											   PG_GET_COLLATION(),
+											   scalar->value,
+											   PG_GETARG_DATUM(2)));
+	}
+
+	if (!equal)
+		PG_RETURN_BOOL(false);
+
+	expires = scalar->expires;
+	checkMemoryLimits(variable->package);
+	markVariableChanged(variable, false);
+	scalar = &(GetActualValue(variable).scalar);
+	setScalarValue(variable, PG_ARGISNULL(3) ? 0 : PG_GETARG_DATUM(3),
+				   PG_ARGISNULL(3));
+	scalar->expires = expires;
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Get the type of array variables with elements of the type 'elemtype'.
+ */
+static Oid
+getArrayType(Oid elemtype)
+{
+	Oid			typid = get_array_type(elemtype);
+
+	if (!OidIsValid(typid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("could not find array type for data type %s",
+						format_type_be(elemtype))));
+
+	return typid;
+}
+
+/*
+ * Find an array variable with elements of the type 'elemtype' by names of
+ * the package and the variable passed as the first arguments. Returns NULL
+ * if there is no such variable and 'strict' is false.
+ */
+static Variable *
+getArrayVariable(FunctionCallInfo fcinfo, Oid elemtype, bool strict)
+{
+	Package    *package;
+	Variable   *variable;
+
+	variable = getCallSiteVariable(fcinfo->flinfo, PG_GETARG_TEXT_PP(0),
+								   PG_GETARG_TEXT_PP(1));
+	if (variable != NULL && variable->is_array &&
+		GetActualValue(variable).array.data->elemtype == elemtype &&
+		GetActualState(variable)->is_valid)
+		return variable;
+
+	package = getPackageByName(PG_GETARG_TEXT_PP(0), false, strict);
+	if (package == NULL)
+		return NULL;
+
+	variable = getVariableInternal(package, PG_GETARG_TEXT_PP(1),
+								   getArrayType(elemtype), strict);
+	if (variable == NULL || !GetActualState(variable)->is_valid)
+		return NULL;
+
+	setCallSiteVariable(fcinfo->flinfo, variable);
+	return variable;
+}
+
+/*
+ * Append the value to the array variable, create the variable if it doesn't
+ * exist.
+ */
+Datum
+variable_push(PG_FUNCTION_ARGS)
+{
+	Oid			elemtype;
+	bool		is_transactional;
+	Package    *package;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	elemtype = get_fn_expr_argtype(fcinfo->flinfo, 2);
+	is_transactional = PG_GETARG_BOOL(3);
+
+	variable = getCallSiteVariable(fcinfo->flinfo, PG_GETARG_TEXT_PP(0),
+								   PG_GETARG_TEXT_PP(1));
+	if (variable != NULL && variable->is_array &&
+		GetActualValue(variable).array.data->elemtype == elemtype &&
+		variable->is_transactional == is_transactional)
+	{
+		checkMemoryLimits(variable->package);
+		markVariableChanged(variable, false);
+	}
+	else
+	{
+		package = getPackageByName(PG_GETARG_TEXT_PP(0), true, false);
+		checkMemoryLimits(package);
+		variable = createVariableInternal(package, PG_GETARG_TEXT_PP(1),
+										  getArrayType(elemtype), true,
+										  is_transactional);
+		setCallSiteVariable(fcinfo->flinfo, variable);
+	}
+
+	push_array_elem(variable, PG_ARGISNULL(2) ? 0 : PG_GETARG_DATUM(2),
+					PG_ARGISNULL(2));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Get the element of the array variable, NULL if the index is out of bounds.
+ */
+Datum
+variable_get_elem(PG_FUNCTION_ARGS)
+{
+	Variable   *variable;
+	Datum		value;
+	bool		is_null;
+
+	CHECK_ARGS_FOR_NULL();
+
+	variable = getArrayVariable(fcinfo,
+								get_fn_expr_argtype(fcinfo->flinfo, 3),
+								PG_GETARG_BOOL(4));
+	if (variable == NULL || PG_ARGISNULL(2))
+		PG_RETURN_NULL();
+
+	value = get_array_elem(variable, PG_GETARG_INT32(2), &is_null);
+	if (is_null)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(value);
+}
+
+/*
+ * Replace the element of the array variable.
+ */
+Datum
+variable_set_elem(PG_FUNCTION_ARGS)
+{
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("array index can not be NULL")));
+
+	variable = getArrayVariable(fcinfo,
+								get_fn_expr_argtype(fcinfo->flinfo, 3),
+								true);
+
+	checkMemoryLimits(variable->package);
+	markVariableChanged(variable, false);
+	set_array_elem(variable, PG_GETARG_INT32(2),
+				   PG_ARGISNULL(3) ? 0 : PG_GETARG_DATUM(3), PG_ARGISNULL(3));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Get the number of elements of the array variable.
+ */
+Datum
+variable_len(PG_FUNCTION_ARGS)
+{
+	Package    *package;
+	Variable   *variable;
+	char		key[NAMEDATALEN];
+
+	CHECK_ARGS_FOR_NULL();
+
+	package = getPackageByName(PG_GETARG_TEXT_PP(0), false, true);
+	getKeyFromName(PG_GETARG_TEXT_PP(1), key);
+	variable = findVariable(package, key);
+
+	if (variable == NULL || !GetActualState(variable)->is_valid)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized variable \"%s\"", key)));
+	if (!variable->is_array)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("variable \"%s\" is not an array", key)));
+
+	PG_RETURN_INT32(GetActualValue(variable).array.data->nelems);
+}
+
+
+Datum
+variable_insert(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	HeapTupleHeader rec;
+	Package	   *package;
+	Variable   *variable;
+	bool		is_transactional;
+	TimestampTz expires;
+	instr_time	call_start;
+
+	Oid			tupType;
+	int32		tupTypmod;
+	TupleDesc	tupdesc;
+	RecordVar  *record;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("record argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
 	rec = PG_GETARG_HEAPTUPLEHEADER(2);
+	is_transactional = PG_GETARG_BOOL(3);
+	expires = PG_NARGS() > 4 ? getExpirationTime(fcinfo, 4) : 0;
+
+	package = getPackageByName(package_name, true, false);
+	checkMemoryLimits(package);
+	variable = createVariableInternal(package, var_name, RECORDOID, false,
+									  is_transactional);
 
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0)
+	/* Insert a record */
+	tupType = HeapTupleHeaderGetTypeId(rec);
+	tupTypmod = HeapTupleHeaderGetTypMod(rec);
+	tupdesc = lookup_rowtype_tupdesc(tupType, tupTypmod);
+
+	record = GetActualValue(variable).record;
+	if (!record->tupdesc)
 	{
-		package = getPackageByName(package_name, false, true);
-		LastPackage = package;
-		LastVariable = NULL;
+		/*
+		 * This is the first record for the var_name. Initialize record.
+		 */
+		init_record(record, tupdesc, variable, NUMVARIABLES);
 	}
 	else
-		package = LastPackage;
+		check_attributes(variable, tupdesc);
+
+	insert_record(variable, rec, expires);
+
+	/* Release resources */
+	ReleaseTupleDesc(tupdesc);
+
+	PROFILE_END(PROFILE_INSERT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Insert all records returned by a query. The variable is resolved and the
+ * records structure is checked only once. If the variable is created by the
+ * call its records hash is presized using the planner's estimate of rows.
+ */
+Datum
+variable_load(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	char	   *query;
+	bool		is_transactional;
+	Package	   *package;
+	Variable   *variable = NULL;
+	RecordVar  *record;
+	TupleDesc	tupdesc = NULL;
+	SPIPlanPtr	plan;
+	Portal		portal;
+	PlannedStmt *stmt;
+	long		nelem = NUMVARIABLES;
+	int64		nrecords = 0;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("query argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	query = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	is_transactional = PG_GETARG_BOOL(3);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+
+	plan = SPI_prepare(query, 0, NULL);
+	if (plan == NULL)
+		elog(ERROR, "SPI_prepare(\"%s\") failed: %s",
+			 query, SPI_result_code_string(SPI_result));
+
+	if (!SPI_is_cursor_plan(plan))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("query \"%s\" does not return tuples", query)));
+
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, false);
+
+	/* Use the planner's estimate to presize the records hash */
+	stmt = (PlannedStmt *) PortalGetPrimaryStmt(portal);
+	if (stmt != NULL && IsA(stmt, PlannedStmt) && stmt->planTree != NULL)
+		nelem = (long) Min(stmt->planTree->plan_rows, PGV_LOAD_MAX_PRESIZE);
+
+	for (;;)
+	{
+		SPITupleTable *tuptable;
+		uint64		i;
+
+		SPI_cursor_fetch(portal, true, PGV_LOAD_BATCH_SIZE);
+		tuptable = SPI_tuptable;
+
+		/* Resolve the variable and check records structure once */
+		if (variable == NULL)
+		{
+			if (tuptable->tupdesc->natts < 1)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("query \"%s\" should return at least one column",
+								query)));
+
+			/*
+			 * Stored records should have a registered type. Each fetch
+			 * returns its own copy of the descriptor, so keep the blessed one.
+			 */
+			tupdesc = BlessTupleDesc(CreateTupleDescCopy(tuptable->tupdesc));
+
+			package = getPackageByName(package_name, true, false);
+			checkMemoryLimits(package);
+			variable = createVariableInternal(package, var_name, RECORDOID,
+											  false, is_transactional);
+
+			record = GetActualValue(variable).record;
+			if (!record->tupdesc)
+				init_record(record, tupdesc, variable, nelem);
+			else
+				check_attributes(variable, tupdesc);
+		}
+		else
+			checkMemoryLimits(package);
+
+		if (SPI_processed == 0)
+			break;
+
+		for (i = 0; i < SPI_processed; i++)
+			insert_record_tuple(variable, tuptable->vals[i], tupdesc);
+
+		nrecords += SPI_processed;
+		SPI_freetuptable(tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_INT64(nrecords);
+}
+
+/*
+ * Get rid of holes in the dense records storage of the variable.
+ */
+Datum
+variable_compact(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Package	   *package;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	if (GetActualValue(variable).record->tupdesc)
+		compact_records(variable);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Write the value of a scalar variable or of an element into the dump.
+ */
+static void
+dumpValue(StringInfo buf, Datum value, bool is_null, int16 typlen,
+		  bool typbyval)
+{
+	pq_sendbyte(buf, is_null);
+	if (!is_null && typbyval)
+		pq_sendbytes(buf, (char *) &value, sizeof(Datum));
+	else if (!is_null)
+	{
+		Size		size;
+
+		if (typlen == -1)
+			value = PointerGetDatum(PG_DETOAST_DATUM(value));
+		size = datumGetSize(value, false, typlen);
+
+		pq_sendint(buf, size, 4);
+		pq_sendbytes(buf, DatumGetPointer(value), size);
+	}
+}
+
+/*
+ * Read a value written by dumpValue(). The value points into the dump.
+ */
+static Datum
+restoreValue(StringInfo buf, Variable *variable, int16 typlen, bool typbyval,
+			 bool *is_null)
+{
+	Datum		value = 0;
+
+	*is_null = pq_getmsgbyte(buf);
+	if (!*is_null && typbyval)
+		memcpy(&value, pq_getmsgbytes(buf, sizeof(Datum)), sizeof(Datum));
+	else if (!*is_null)
+	{
+		int			size = pq_getmsgint(buf, 4);
+
+		value = PointerGetDatum(pq_getmsgbytes(buf, size));
+		if (datumGetSize(value, false, typlen) != size)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid value of variable \"%s\" in dump",
+							GetName(variable))));
+	}
+
+	return value;
+}
+
+/*
+ * Dump variables of the package into a binary string which can be loaded by
+ * pgv_restore(). Values and tuples are written in the internal format, so the
+ * dump can be restored only by the same major version of the server.
+ */
+Datum
+package_dump(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	Package    *package;
+	StringInfoData buf;
+	int			i;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	package = getPackageByName(package_name, false, true);
+
+	pq_begintypsend(&buf);
+	pq_sendint(&buf, PGV_DUMP_MAGIC, 4);
+	pq_sendint(&buf, PGV_DUMP_VERSION, 4);
+	pq_sendint(&buf, PG_VERSION_NUM / 100, 4);
+	pq_sendstring(&buf, GetName(package));
+
+	for (i = 0; i < 2; i++)
+	{
+		HASH_SEQ_STATUS vstat;
+		Variable   *variable;
+
+		hash_seq_init(&vstat, i ? package->varHashTransact :
+					  package->varHashRegular);
+		while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+		{
+			if (!isVariableVisible(variable))
+				continue;
+
+			/* Each variable is preceded by a flag, the last flag is zero */
+			pq_sendbyte(&buf, 1);
+			pq_sendstring(&buf, GetName(variable));
+			pq_sendint(&buf, variable->typid, 4);
+			pq_sendbyte(&buf, variable->is_array);
+			pq_sendbyte(&buf, variable->is_transactional);
+
+			if (variable->typid == RECORDOID)
+			{
+				RecordVar  *record = GetActualValue(variable).record;
+
+				pq_sendbyte(&buf, record->tupdesc != NULL);
+				if (record->tupdesc)
+					dump_records(record, &buf);
+			}
+			else if (variable->is_array)
+			{
+				ArrayVar   *array = GetActualValue(variable).array.data;
+				int			j;
+
+				pq_sendint(&buf, array->typlen, 2);
+				pq_sendbyte(&buf, array->typbyval);
+				pq_sendint(&buf, array->nelems, 4);
+				for (j = 0; j < array->nelems; j++)
+					dumpValue(&buf, array->values[j], array->nulls[j],
+							  array->typlen, array->typbyval);
+			}
+			else
+			{
+				ScalarVar  *scalar = &(GetActualValue(variable).scalar);
+
+				pq_sendint(&buf, scalar->typlen, 2);
+				pq_sendbyte(&buf, scalar->typbyval);
+				dumpValue(&buf, scalar->value, scalar->is_null,
+						  scalar->typlen, scalar->typbyval);
+			}
+		}
+	}
+	pq_sendbyte(&buf, 0);
+
+	PG_FREE_IF_COPY(package_name, 0);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Create the package and its variables from a dump made by pgv_dump().
+ * Existing scalar variables get values from the dump, records and elements
+ * are added to existing record and array variables.
+ */
+Datum
+package_restore(PG_FUNCTION_ARGS)
+{
+	bytea	   *dump;
+	StringInfoData buf;
+	Package    *package;
+	text	   *name;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("dump can not be NULL")));
+
+	dump = PG_GETARG_BYTEA_PP(0);
+
+	/* Read the dump in place */
+	buf.data = VARDATA_ANY(dump);
+	buf.len = VARSIZE_ANY_EXHDR(dump);
+	buf.maxlen = buf.len;
+	buf.cursor = 0;
+
+	if (buf.len < 12 ||
+		pq_getmsgint(&buf, 4) != PGV_DUMP_MAGIC ||
+		pq_getmsgint(&buf, 4) != PGV_DUMP_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid dump of package")));
+
+	if (pq_getmsgint(&buf, 4) != PG_VERSION_NUM / 100)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("dump of package was made by another server version")));
+
+	name = cstring_to_text(pq_getmsgstring(&buf));
+	package = getPackageByName(name, true, false);
+	pfree(name);
+
+	while (pq_getmsgbyte(&buf))
+	{
+		Variable   *variable;
+		Oid			typid;
+		bool		is_array;
+		bool		is_transactional;
+
+		name = cstring_to_text(pq_getmsgstring(&buf));
+		typid = pq_getmsgint(&buf, 4);
+		is_array = pq_getmsgbyte(&buf);
+		is_transactional = pq_getmsgbyte(&buf);
+		if (is_array && !type_is_array(typid))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid dump of package")));
+
+		checkMemoryLimits(package);
+		variable = createVariableInternal(package, name, typid, is_array,
+										  is_transactional);
+
+		if (typid == RECORDOID)
+		{
+			if (pq_getmsgbyte(&buf))
+				restore_records(variable, &buf);
+		}
+		else
+		{
+			int16		typlen = pq_getmsgint(&buf, 2);
+			bool		typbyval = pq_getmsgbyte(&buf);
+			int16		vartyplen;
+			bool		vartypbyval;
+			Datum		value;
+			bool		is_null;
+
+			if (variable->is_array)
+			{
+				vartyplen = GetActualValue(variable).array.data->typlen;
+				vartypbyval = GetActualValue(variable).array.data->typbyval;
+			}
+			else
+			{
+				vartyplen = GetActualValue(variable).scalar.typlen;
+				vartypbyval = GetActualValue(variable).scalar.typbyval;
+			}
+			if (vartyplen != typlen || vartypbyval != typbyval)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("type of variable \"%s\" differs from the type in dump",
+								GetName(variable))));
+
+			if (variable->is_array)
+			{
+				int			nelems = pq_getmsgint(&buf, 4);
+
+				while (nelems-- > 0)
+				{
+					value = restoreValue(&buf, variable, typlen, typbyval,
+										 &is_null);
+					push_array_elem(variable, value, is_null);
+				}
+			}
+			else
+			{
+				value = restoreValue(&buf, variable, typlen, typbyval,
+									 &is_null);
+				setScalarValue(variable, value, is_null);
+			}
+		}
+
+		pfree(name);
+	}
+
+	pq_getmsgend(&buf);
+
+	PG_FREE_IF_COPY(dump, 0);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Write records of the variable into a file which can be mapped by pgv_map().
+ */
+Datum
+variable_save(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	char	   *filename;
+	Package    *package;
+	Variable   *variable;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("file name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	filename = text_to_cstring(PG_GETARG_TEXT_PP(2));
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	save_records(variable, filename);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Create a read-only record variable which records are mapped from a file
+ * written by pgv_save().
+ */
+Datum
+variable_map(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	char	   *filename;
+	Package    *package;
+	Variable   *variable;
+	struct MappedRecords *mapped;
+	TupleDesc	tupdesc;
+
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("file name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	filename = text_to_cstring(PG_GETARG_TEXT_PP(2));
+
+	/* The file is validated before a variable is created */
+	mapped = open_mapped_records(filename, &tupdesc);
+
+	package = getPackageByName(package_name, true, false);
+	variable = createVariableInternal(package, var_name, RECORDOID, false,
+									  false);
+
+	map_records(variable, mapped, tupdesc);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	PG_RETURN_VOID();
+}
+
+Datum
+variable_update(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	HeapTupleHeader rec;
+	Package	   *package;
+	Variable   *variable;
+	TransObject *transObject;
+	bool		res;
+	Oid			tupType;
+	int32		tupTypmod;
+	TupleDesc	tupdesc;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("record argument can not be NULL")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	rec = PG_GETARG_HEAPTUPLEHEADER(2);
 
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
-	{
-		variable = getVariableInternal(package, var_name, RECORDOID, true);
-		LastVariable = variable;
-	}
-	else
-		variable = LastVariable;
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+	checkMemoryLimits(package);
 
 	transObject = &variable->transObject;
 	if (variable->is_transactional &&
@@ -488,30 +1684,8 @@ variable_delete(PG_FUNCTION_ARGS)
 		value = 0;
 	}
 
-	/* Get cached package */
-	if (LastPackage == NULL ||
-		VARSIZE_ANY_EXHDR(package_name) != strlen(GetName(LastPackage)) ||
-		strncmp(VARDATA_ANY(package_name), GetName(LastPackage),
-				VARSIZE_ANY_EXHDR(package_name)) != 0)
-	{
-		package = getPackageByName(package_name, false, true);
-		LastPackage = package;
-		LastVariable = NULL;
-	}
-	else
-		package = LastPackage;
-
-	/* Get cached variable */
-	if (LastVariable == NULL ||
-		VARSIZE_ANY_EXHDR(var_name) != strlen(GetName(LastVariable)) ||
-		strncmp(VARDATA_ANY(var_name), GetName(LastVariable),
-				VARSIZE_ANY_EXHDR(var_name)) != 0)
-	{
-		variable = getVariableInternal(package, var_name, RECORDOID, true);
-		LastVariable = variable;
-	}
-	else
-		variable = LastVariable;
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
 
 	transObject = &variable->transObject;
 	if (variable->is_transactional &&
@@ -533,93 +1707,503 @@ variable_delete(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(res);
 }
 
+/*
+ * Prepare the materialize mode result of a set-returning function. The
+ * returned tuplestore should be filled by the caller.
+ */
+static Tuplestorestate *
+initMaterializedResult(FunctionCallInfo fcinfo, TupleDesc tupdesc)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	/* Result may be returned as composite datum */
+	rsinfo->setDesc = BlessTupleDesc(CreateTupleDescCopy(tupdesc));
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return tupstore;
+}
+
+/*
+ * Return all records of the variable. Records are copied into a tuplestore at
+ * once, so the result isn't affected by changes of the variable made while it
+ * is read.
+ */
 Datum
 variable_select(PG_FUNCTION_ARGS)
 {
-	FuncCallContext *funcctx;
-	HASH_SEQ_STATUS *rstat;
+	text	   *package_name;
+	text	   *var_name;
+	Package	   *package;
+	Variable   *variable;
+	RecordVar  *record;
+	Tuplestorestate *tupstore;
+	HASH_SEQ_STATUS rstat;
 	HashRecordEntry *item;
+	instr_time	call_start;
 
-	if (SRF_IS_FIRSTCALL())
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	record = GetActualValue(variable).record;
+
+	tupstore = initMaterializedResult(fcinfo, record->tupdesc);
+
+	if (record->mapped)
 	{
-		text	   *package_name;
-		text	   *var_name;
-		Package	   *package;
-		Variable   *variable;
-		MemoryContext oldcontext;
-		RecordVar  *record;
+		uint64		pos = 0;
+		HeapTupleData tuple;
+
+		while (get_mapped_record(record, &pos, &tuple))
+			tuplestore_puttuple(tupstore, &tuple);
+	}
+	else
+	{
+		TimestampTz now = GetCurrentTimestamp();
+
+		hash_seq_init(&rstat, record->rhash);
+		while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		{
+			if (!RecordExpired(item, now))
+				tuplestore_puttuple(tupstore, item->tuple);
+		}
+	}
+
+	PROFILE_END(PROFILE_SELECT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	return (Datum) 0;
+}
+
+Datum
+variable_select_by_value(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Oid			value_type;
+	Datum		value;
+	bool		value_is_null = PG_ARGISNULL(2);
+	Package	   *package;
+	Variable   *variable;
+	instr_time	call_start;
+
+	RecordVar  *record;
+	HeapTuple	tuple;
+
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	if (!value_is_null)
+	{
+		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+		value = PG_GETARG_DATUM(2);
+	}
+	else
+	{
+		value_type = InvalidOid;
+		value = 0;
+	}
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	if (!value_is_null)
+		check_record_key(variable, value_type);
+
+	record = GetActualValue(variable).record;
+
+	/* Search a record */
+	tuple = search_record(record, value, value_is_null);
+
+	PROFILE_END(PROFILE_SELECT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	if (tuple)
+		PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+	else
+		PG_RETURN_NULL();
+}
+
+/*
+ * Common part of variable_select_by_values() and variable_select_ordinality().
+ * All keys of the array are looked up in one call and found records are put
+ * into a tuplestore. If 'ordinality' is true, each record is preceded by the
+ * position of its key in the array.
+ */
+static void
+selectByValues(FunctionCallInfo fcinfo, bool ordinality)
+{
+	text	   *package_name;
+	text	   *var_name;
+	ArrayType  *values;
+	Package	   *package;
+	Variable   *variable;
+	RecordVar  *record;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	ArrayIterator iterator;
+	Datum		value;
+	bool		isnull;
+	Datum	   *rvalues = NULL;
+	bool	   *rnulls = NULL;
+	int64		pos = 0;
+	instr_time	call_start;
+
+	/* Checks */
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("array argument can not be NULL")));
+
+	values = PG_GETARG_ARRAYTYPE_P(2);
+	if (ARR_NDIM(values) > 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("searching for elements in multidimensional arrays is not supported")));
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	check_record_key(variable, ARR_ELEMTYPE(values));
+
+	record = GetActualValue(variable).record;
+
+	if (ordinality)
+	{
+		int			natts = record->tupdesc->natts;
+		int			i;
+
+#if PG_VERSION_NUM >= 120000
+		tupdesc = CreateTemplateTupleDesc(natts + 1);
+#else
+		tupdesc = CreateTemplateTupleDesc(natts + 1, false);
+#endif
+		TupleDescInitEntry(tupdesc, (AttrNumber) 1, "ordinality",
+						   INT8OID, -1, 0);
+		for (i = 0; i < natts; i++)
+			TupleDescCopyEntry(tupdesc, (AttrNumber) (i + 2),
+							   record->tupdesc, (AttrNumber) (i + 1));
+
+		rvalues = (Datum *) palloc((natts + 1) * sizeof(Datum));
+		rnulls = (bool *) palloc((natts + 1) * sizeof(bool));
+	}
+	else
+		tupdesc = record->tupdesc;
+
+	tupstore = initMaterializedResult(fcinfo, tupdesc);
+
+	/* Search records for all array elements */
+	iterator = array_create_iterator(values, 0, NULL);
+	while (array_iterate(iterator, &value, &isnull))
+	{
+		HeapTuple	tuple;
+
+		pos++;
+
+		tuple = search_record(record, value, isnull);
+		if (tuple == NULL)
+			continue;
+
+		if (ordinality)
+		{
+			rvalues[0] = Int64GetDatum(pos);
+			rnulls[0] = false;
+			heap_deform_tuple(tuple, record->tupdesc,
+							  rvalues + 1, rnulls + 1);
+			tuplestore_putvalues(tupstore, tupdesc, rvalues, rnulls);
+		}
+		else
+			tuplestore_puttuple(tupstore, tuple);
+
+		/* Mapped records are copied by search_record() */
+		if (record->mapped)
+			heap_freetuple(tuple);
+	}
+	array_free_iterator(iterator);
+
+	PROFILE_END(PROFILE_SELECT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+}
+
+Datum
+variable_select_by_values(PG_FUNCTION_ARGS)
+{
+	selectByValues(fcinfo, false);
+
+	return (Datum) 0;
+}
+
+/*
+ * Same as variable_select_by_values(), but records are preceded by positions
+ * of their keys in the array.
+ */
+Datum
+variable_select_ordinality(PG_FUNCTION_ARGS)
+{
+	selectByValues(fcinfo, true);
+
+	return (Datum) 0;
+}
+
+/*
+ * Common part of variable_select_ordered() and variable_select_range().
+ * Returns records of the variable in the order of their keys. If 'range' is
+ * true only records with keys between non-NULL third and fourth arguments are
+ * returned.
+ */
+static void
+selectSortedRecords(FunctionCallInfo fcinfo, bool range)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Package	   *package;
+	Variable   *variable;
+	RecordVar  *record;
+	Tuplestorestate *tupstore;
+	HashRecordEntry **sorted;
+	long		nsorted;
+	long		start,
+				end,
+				i;
+	TimestampTz now;
+	instr_time	call_start;
+
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	record = GetActualValue(variable).record;
+	sorted = get_sorted_records(record, &nsorted);
+
+	start = 0;
+	end = nsorted;
+	if (range)
+	{
+		/* The record with NULL key is the last one and isn't in a range */
+		if (end > 0 && sorted[end - 1]->key.is_null)
+			end--;
+
+		if (!PG_ARGISNULL(2))
+		{
+			check_record_key(variable,
+							 get_fn_expr_argtype(fcinfo->flinfo, 2));
+			start = search_sorted_records(record, PG_GETARG_DATUM(2),
+										  false, false);
+		}
+		if (!PG_ARGISNULL(3))
+		{
+			check_record_key(variable,
+							 get_fn_expr_argtype(fcinfo->flinfo, 3));
+			end = Min(end, search_sorted_records(record, PG_GETARG_DATUM(3),
+												 false, true));
+		}
+	}
+
+	tupstore = initMaterializedResult(fcinfo, record->tupdesc);
+
+	now = GetCurrentTimestamp();
+	for (i = start; i < end; i++)
+	{
+		if (!RecordExpired(sorted[i], now))
+			tuplestore_puttuple(tupstore, sorted[i]->tuple);
+	}
+
+	PROFILE_END(PROFILE_SELECT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+}
+
+/*
+ * Return records of the variable in the order of their keys.
+ */
+Datum
+variable_select_ordered(PG_FUNCTION_ARGS)
+{
+	selectSortedRecords(fcinfo, false);
+
+	return (Datum) 0;
+}
+
+/*
+ * Return records with keys between the bounds in the order of their keys.
+ * NULL bound means that the range is not limited from that side.
+ */
+Datum
+variable_select_range(PG_FUNCTION_ARGS)
+{
+	selectSortedRecords(fcinfo, true);
+
+	return (Datum) 0;
+}
+
+/*
+ * Return the record with the greatest key which is less than or equal to the
+ * value.
+ */
+Datum
+variable_select_le(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	Package	   *package;
+	Variable   *variable;
+	RecordVar  *record;
+	HashRecordEntry **sorted;
+	long		nsorted;
+	long		pos;
+	TimestampTz now;
+	instr_time	call_start;
+
+	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
 
-		CHECK_ARGS_FOR_NULL();
+	/* Nothing is less than or equal to NULL */
+	if (PG_ARGISNULL(2))
+		PG_RETURN_NULL();
+
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
+
+	check_record_key(variable, get_fn_expr_argtype(fcinfo->flinfo, 2));
 
-		/* Get arguments */
-		package_name = PG_GETARG_TEXT_PP(0);
-		var_name = PG_GETARG_TEXT_PP(1);
+	record = GetActualValue(variable).record;
+	sorted = get_sorted_records(record, &nsorted);
+	pos = search_sorted_records(record, PG_GETARG_DATUM(2), false, true) - 1;
 
-		package = getPackageByName(package_name, false, true);
-		variable = getVariableInternal(package, var_name, RECORDOID, true);
+	/* Expired records are not returned, the previous key is taken then */
+	now = GetCurrentTimestamp();
+	while (pos >= 0 && RecordExpired(sorted[pos], now))
+		pos--;
+
+	PROFILE_END(PROFILE_SELECT, call_start);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
 
-		record = &(GetActualValue(variable).record);
+	if (pos >= 0)
+		PG_RETURN_DATUM(HeapTupleGetDatum(sorted[pos]->tuple));
+	else
+		PG_RETURN_NULL();
+}
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+/*
+ * Create a hash index on a column of the variable records.
+ */
+Datum
+variable_create_index(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	char	   *column_name;
+	Package	   *package;
+	Variable   *variable;
 
-		funcctx->tuple_desc = CreateTupleDescCopy(record->tupdesc);
+	CHECK_ARGS_FOR_NULL();
 
-		rstat = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
-		hash_seq_init(rstat, record->rhash);
-		funcctx->user_fctx = rstat;
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("column name can not be NULL")));
 
-		MemoryContextSwitchTo(oldcontext);
-		PG_FREE_IF_COPY(package_name, 0);
-		PG_FREE_IF_COPY(var_name, 1);
-	}
+	/* Get arguments */
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	column_name = text_to_cstring(PG_GETARG_TEXT_PP(2));
 
-	funcctx = SRF_PERCALL_SETUP();
+	package = getPackageByName(package_name, false, true);
+	variable = getVariableInternal(package, var_name, RECORDOID, true);
 
-	/* Get next hash record */
-	rstat = (HASH_SEQ_STATUS *) funcctx->user_fctx;
-	item = (HashRecordEntry *) hash_seq_search(rstat);
-	if (item != NULL)
-	{
-		Datum		result;
+	create_record_index(variable, column_name);
 
-		result = HeapTupleGetDatum(item->tuple);
+	pfree(column_name);
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
 
-		SRF_RETURN_NEXT(funcctx, result);
-	}
-	else
-	{
-		pfree(rstat);
-		SRF_RETURN_DONE(funcctx);
-	}
+	PG_RETURN_VOID();
 }
 
+/*
+ * Return records with the value of the indexed column.
+ */
 Datum
-variable_select_by_value(PG_FUNCTION_ARGS)
+variable_select_by(PG_FUNCTION_ARGS)
 {
 	text	   *package_name;
 	text	   *var_name;
+	char	   *column_name;
 	Oid			value_type;
 	Datum		value;
-	bool		value_is_null = PG_ARGISNULL(2);
+	bool		value_is_null = PG_ARGISNULL(3);
 	Package	   *package;
 	Variable   *variable;
-
-	HashRecordEntry *item;
-	RecordVar  *record;
-	HashRecordKey k;
-	bool		found;
+	RecordIndexEntry *entry;
+	Tuplestorestate *tupstore;
+	instr_time	call_start;
 
 	CHECK_ARGS_FOR_NULL();
+	PROFILE_START(call_start);
+
+	if (PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("column name can not be NULL")));
 
 	/* Get arguments */
 	package_name = PG_GETARG_TEXT_PP(0);
 	var_name = PG_GETARG_TEXT_PP(1);
+	column_name = text_to_cstring(PG_GETARG_TEXT_PP(2));
 
 	if (!value_is_null)
 	{
-		value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
-		value = PG_GETARG_DATUM(2);
+		value_type = get_fn_expr_argtype(fcinfo->flinfo, 3);
+		value = PG_GETARG_DATUM(3);
 	}
 	else
 	{
@@ -630,125 +2214,145 @@ variable_select_by_value(PG_FUNCTION_ARGS)
 	package = getPackageByName(package_name, false, true);
 	variable = getVariableInternal(package, var_name, RECORDOID, true);
 
-	if (!value_is_null)
-		check_record_key(variable, value_type);
-
-	record = &(GetActualValue(variable).record);
+	entry = search_record_index(variable, column_name, value_type,
+								value, value_is_null);
 
-	/* Search a record */
-	k.value = value;
-	k.is_null = value_is_null;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+	tupstore = initMaterializedResult(fcinfo,
+									  GetActualValue(variable).record->tupdesc);
+	if (entry != NULL)
+	{
+		TimestampTz now = GetCurrentTimestamp();
+		int			i;
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_FIND, &found);
+		for (i = 0; i < entry->nitems; i++)
+		{
+			if (!RecordExpired(entry->items[i], now))
+				tuplestore_puttuple(tupstore, entry->items[i]->tuple);
+		}
+	}
 
+	PROFILE_END(PROFILE_SELECT, call_start);
+	pfree(column_name);
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
-	if (found)
-		PG_RETURN_DATUM(HeapTupleGetDatum(item->tuple));
-	else
-		PG_RETURN_NULL();
+	return (Datum) 0;
 }
 
-/* Structure for variable_select_by_values() */
-typedef struct
+#if PG_VERSION_NUM >= 120000
+/*
+ * Estimate the number of rows returned by pgv_select() call 'expr'. Returns
+ * false if there is no useful estimate, e.g. names of the package and the
+ * variable are not constants.
+ */
+static bool
+estimateSelectRows(FuncExpr *expr, double *rows)
 {
-	Variable   *variable;
-	ArrayIterator iterator;
-}			VariableIteratorRec;
+	Const	   *pname,
+			   *vname;
+	Package    *package;
+	Variable   *variable = NULL;
+	double		nrecords = -1;
+	double		nvalues = -1;
+
+	if (list_length(expr->args) < 2)
+		return false;
 
-Datum
-variable_select_by_values(PG_FUNCTION_ARGS)
-{
-	FuncCallContext *funcctx;
-	VariableIteratorRec *var;
-	Datum		value;
-	HashRecordEntry *item;
-	bool		isnull;
+	pname = (Const *) linitial(expr->args);
+	vname = (Const *) lsecond(expr->args);
 
-	if (SRF_IS_FIRSTCALL())
+	/* Look up the variable if it is known at planning time */
+	if (IsA(pname, Const) && !pname->constisnull &&
+		IsA(vname, Const) && !vname->constisnull)
 	{
-		text	   *package_name;
-		text	   *var_name;
-		ArrayType  *values;
-		Package	   *package;
-		Variable   *variable;
-		MemoryContext oldcontext;
+		package = getPackageByName(DatumGetTextPP(pname->constvalue),
+								   false, false);
+		if (package)
+		{
+			char		key[NAMEDATALEN];
 
-		/* Checks */
-		CHECK_ARGS_FOR_NULL();
+			getKeyFromName(DatumGetTextPP(vname->constvalue), key);
+			variable = findVariable(package, key);
+		}
+	}
 
-		if (PG_ARGISNULL(2))
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					 errmsg("array argument can not be NULL")));
+	/* Don't complain about wrong variables here, pgv_select() does it */
+	if (variable && variable->typid == RECORDOID &&
+		GetActualState(variable)->is_valid)
+		nrecords = count_records(GetActualValue(variable).record);
 
-		values = PG_GETARG_ARRAYTYPE_P(2);
-		if (ARR_NDIM(values) > 1)
-			ereport(ERROR,
-					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-					 errmsg("searching for elements in multidimensional arrays is not supported")));
+	/* The form which takes an array of keys returns at most one row per key */
+	if (list_length(expr->args) == 3)
+	{
+		Const	   *values = (Const *) lthird(expr->args);
 
-		/* Get arguments */
-		package_name = PG_GETARG_TEXT_PP(0);
-		var_name = PG_GETARG_TEXT_PP(1);
+		if (IsA(values, Const))
+		{
+			if (values->constisnull)
+				nvalues = 0;
+			else
+			{
+				ArrayType  *arr = DatumGetArrayTypeP(values->constvalue);
 
-		package = getPackageByName(package_name, false, true);
-		variable = getVariableInternal(package, var_name, RECORDOID, true);
+				nvalues = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+			}
+		}
+	}
 
-		check_record_key(variable, ARR_ELEMTYPE(values));
+	if (nrecords >= 0 && nvalues >= 0)
+		*rows = Min(nrecords, nvalues);
+	else if (nrecords >= 0)
+		*rows = nrecords;
+	else if (nvalues >= 0)
+		*rows = nvalues;
+	else
+		return false;
 
-		funcctx = SRF_FIRSTCALL_INIT();
-		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+	*rows = clamp_row_est(*rows);
+	return true;
+}
 
-		funcctx->tuple_desc = CreateTupleDescCopy(GetActualValue(variable).record.tupdesc);
+/*
+ * Planner support function for pgv_select(). Estimates the number of
+ * returned rows by the actual number of records of the variable, and the
+ * costs by the number of rows to copy into the result.
+ */
+Datum
+variable_select_support(PG_FUNCTION_ARGS)
+{
+	Node	   *rawreq = (Node *) PG_GETARG_POINTER(0);
+	Node	   *ret = NULL;
 
-		var = (VariableIteratorRec *) palloc(sizeof(VariableIteratorRec));
-		var->iterator = array_create_iterator(values, 0, NULL);
-		var->variable = variable;
-		funcctx->user_fctx = var;
+	if (IsA(rawreq, SupportRequestRows))
+	{
+		SupportRequestRows *req = (SupportRequestRows *) rawreq;
+		double		rows;
 
-		MemoryContextSwitchTo(oldcontext);
-		PG_FREE_IF_COPY(package_name, 0);
-		PG_FREE_IF_COPY(var_name, 1);
+		if (is_funcclause(req->node) &&
+			estimateSelectRows((FuncExpr *) req->node, &rows))
+		{
+			req->rows = rows;
+			ret = (Node *) req;
+		}
 	}
-
-	funcctx = SRF_PERCALL_SETUP();
-	var = (VariableIteratorRec *) funcctx->user_fctx;
-
-	/* Get next array element */
-	while (array_iterate(var->iterator, &value, &isnull))
+	else if (IsA(rawreq, SupportRequestCost))
 	{
-		HashRecordKey k;
-		bool		found;
-		RecordVar  *record;
+		SupportRequestCost *req = (SupportRequestCost *) rawreq;
+		double		rows;
 
-		record = &(GetActualValue(var->variable).record);
-		/* Search a record */
-		k.value = value;
-		k.is_null = isnull;
-		k.hash_proc = &record->hash_proc;
-		k.cmp_proc = &record->cmp_proc;
-
-		item = (HashRecordEntry *) hash_search(record->rhash, &k,
-											   HASH_FIND, &found);
-		if (found)
+		if (req->node && is_funcclause(req->node) &&
+			estimateSelectRows((FuncExpr *) req->node, &rows))
 		{
-			Datum		result;
-
-			result = HeapTupleGetDatum(item->tuple);
-
-			SRF_RETURN_NEXT(funcctx, result);
+			/* All records are put into the tuplestore by the first call */
+			req->startup = rows * cpu_operator_cost;
+			req->per_tuple = cpu_operator_cost;
+			ret = (Node *) req;
 		}
 	}
 
-	array_free_iterator(var->iterator);
-	pfree(var);
-	SRF_RETURN_DONE(funcctx);
+	PG_RETURN_POINTER(ret);
 }
+#endif
 
 /*
  * Check if variable exists.
@@ -761,7 +2365,6 @@ variable_exists(PG_FUNCTION_ARGS)
 	Package	   *package;
 	Variable   *variable;
 	char		key[NAMEDATALEN];
-	bool		found;
 
 	CHECK_ARGS_FOR_NULL();
 
@@ -779,16 +2382,12 @@ variable_exists(PG_FUNCTION_ARGS)
 
 	getKeyFromName(var_name, key);
 
-	variable = (Variable *) hash_search(package->varHashRegular,
-										key, HASH_FIND, &found);
-	if (!found)
-		variable = (Variable *) hash_search(package->varHashTransact,
-											key, HASH_FIND, &found);
+	variable = findVariable(package, key);
 
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
-	PG_RETURN_BOOL(found ? GetActualState(variable)->is_valid : found);
+	PG_RETURN_BOOL(variable ? isVariableVisible(variable) : false);
 }
 
 /*
@@ -813,6 +2412,42 @@ package_exists(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(res);
 }
 
+/*
+ * Create a package whose record variables keep at most 'max_memory' bytes of
+ * records each. Least recently used records are evicted to fit the limit.
+ */
+Datum
+package_create_cache(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	int64		max_memory;
+	Package    *package;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
+	if (PG_ARGISNULL(1) || PG_GETARG_INT64(1) <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("memory limit of cache package should be positive")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	max_memory = PG_GETARG_INT64(1);
+
+	package = getPackageByName(package_name, false, false);
+	if (package != NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_DUPLICATE_OBJECT),
+				 errmsg("package \"%s\" already exists", GetName(package))));
+
+	package = getPackageByName(package_name, true, false);
+	package->cacheSize = (Size) max_memory;
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_RETURN_VOID();
+}
+
 /*
  * Remove variable from package by name.
  */
@@ -839,6 +2474,7 @@ remove_variable(PG_FUNCTION_ARGS)
 	if (found)
 	{
 		/* Regular variable */
+		invalidateNameCache(package, variable);
 		removeState(&variable->transObject, TRANS_VARIABLE,
 					GetActualState(variable));
 	}
@@ -864,9 +2500,6 @@ remove_variable(PG_FUNCTION_ARGS)
 		GetActualState(variable)->is_valid = false;
 	}
 
-	/* Remove variable from cache */
-	LastVariable = NULL;
-
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_FREE_IF_COPY(var_name, 1);
 
@@ -901,10 +2534,6 @@ remove_package(PG_FUNCTION_ARGS)
 				 errmsg("unrecognized package \"%s\"", key)));
 	}
 
-	/* Remove package and variable from cache */
-	LastPackage = NULL;
-	LastVariable = NULL;
-
 	PG_FREE_IF_COPY(package_name, 0);
 	PG_RETURN_VOID();
 }
@@ -915,7 +2544,9 @@ removePackageInternal(Package *package)
 	TransObject *transObject;
 
 	/* All regular variables will be freed */
+	invalidateNameCache(package, NULL);
 	MemoryContextDelete(package->hctxRegular);
+	SubMemoryUsage(&package->regularUsage, package->regularUsage);
 
 	/* Add to changes list */
 	transObject = &package->transObject;
@@ -948,9 +2579,85 @@ remove_packages(PG_FUNCTION_ARGS)
 		removePackageInternal(package);
 	}
 
-	/* Remove package and variable from cache */
-	LastPackage = NULL;
-	LastVariable = NULL;
+	PG_RETURN_VOID();
+}
+
+/*
+ * Remove all variables of the package by name but keep the package.
+ */
+Datum
+reset_package(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+
+	if (PG_ARGISNULL(0))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("package name can not be NULL")));
+
+	package_name = PG_GETARG_TEXT_PP(0);
+
+	resetPackageInternal(getPackageByName(package_name, false, true));
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_RETURN_VOID();
+}
+
+/*
+ * Remove all variables of the package. Unlike removal of the package its
+ * memory contexts and hash tables are kept, so the package is refilled
+ * without creating them again. The context of regular variables is reset
+ * and their hash table is created in it again, presized for the previous
+ * number of variables. Transactional variables are removed as by
+ * pgv_remove(), so a rollback brings them back.
+ */
+static void
+resetPackageInternal(Package *package)
+{
+	long		nvars = hash_get_num_entries(package->varHashRegular);
+	HASH_SEQ_STATUS vstat;
+	Variable   *variable;
+
+	invalidateNameCache(package, NULL);
+	MemoryContextReset(package->hctxRegular);
+	SubMemoryUsage(&package->regularUsage, package->regularUsage);
+	createVarsHash(package, false, Max(nvars, NUMVARIABLES));
+
+	hash_seq_init(&vstat, package->varHashTransact);
+	while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+	{
+		TransObject *transObj = &variable->transObject;
+
+		if (!GetActualState(variable)->is_valid)
+			continue;
+
+		if (!isObjectChangedInCurrentTrans(transObj))
+		{
+			createSavepoint(transObj, TRANS_VARIABLE);
+			addToChangesStack(transObj, TRANS_VARIABLE);
+		}
+		GetActualState(variable)->is_valid = false;
+	}
+}
+
+/*
+ * Remove all variables of all packages but keep the packages.
+ */
+Datum
+reset_packages(PG_FUNCTION_ARGS)
+{
+	Package	   *package;
+	HASH_SEQ_STATUS pstat;
+
+	if (packagesHash == NULL)
+		PG_RETURN_VOID();
+
+	hash_seq_init(&pstat, packagesHash);
+	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+	{
+		if (GetActualState(package)->is_valid)
+			resetPackageInternal(package);
+	}
 
 	PG_RETURN_VOID();
 }
@@ -1024,7 +2731,7 @@ get_packages_and_variables(PG_FUNCTION_ARGS)
 					while ((variable =
 							(Variable *) hash_seq_search(&vstat)) != NULL)
 					{
-						if (!GetActualState(variable)->is_valid)
+						if (!isVariableVisible(variable))
 							continue;
 
 						/* Resize recs if necessary */
@@ -1087,7 +2794,10 @@ get_packages_and_variables(PG_FUNCTION_ARGS)
 static void
 getMemoryTotalSpace(MemoryContext context, int level, Size *totalspace)
 {
-#if PG_VERSION_NUM >= 90600
+#if PG_VERSION_NUM >= 130000
+	/* Contexts keep the amount of allocated memory, blocks aren't examined */
+	*totalspace += MemoryContextMemAllocated(context, true);
+#elif PG_VERSION_NUM >= 90600
 	MemoryContext child;
 	MemoryContextCounters totals;
 
@@ -1112,6 +2822,49 @@ getMemoryTotalSpace(MemoryContext context, int level, Size *totalspace)
 #endif
 }
 
+/*
+ * Memory used by variables of the package.
+ */
+static Size
+getPackageSpace(Package *package)
+{
+	Size		totalspace = 0;
+
+	/* Regular variables are freed along with their context on removal */
+	if (GetActualState(package)->is_valid)
+		getMemoryTotalSpace(package->hctxRegular, 0, &totalspace);
+	getMemoryTotalSpace(package->hctxTransact, 0, &totalspace);
+
+	return totalspace;
+}
+
+/*
+ * Raise an error if variables of the backend or of the package already store
+ * more than it is allowed. Limits are checked before new values are stored,
+ * so they may be exceeded by the size of one stored batch.
+ *
+ * Only sizes of stored values are compared with limits, they are counted by
+ * AddMemoryUsage() and SubMemoryUsage() where values are stored or released,
+ * so the check doesn't examine memory contexts.
+ */
+static void
+checkMemoryLimits(Package *package)
+{
+	if (maxMemoryPerBackend > 0 &&
+		backendUsage > (Size) maxMemoryPerBackend * 1024)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("variables use more memory than allowed by pg_variables.max_memory_per_backend")));
+
+	if (maxMemoryPerPackage > 0 &&
+		package->regularUsage + package->transactUsage >
+		(Size) maxMemoryPerPackage * 1024)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("package \"%s\" uses more memory than allowed by pg_variables.max_memory_per_package",
+						GetName(package))));
+}
+
 /*
  * Get list of assigned packages and used memory in bytes.
  */
@@ -1171,21 +2924,12 @@ get_packages_stats(PG_FUNCTION_ARGS)
 		bool		nulls[2];
 		HeapTuple	tuple;
 		Datum		result;
-		Size		totalSpace = 0,
-					regularSpace = 0,
-					transactSpace = 0;
 
 		memset(nulls, 0, sizeof(nulls));
 
 		/* Fill data */
 		values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
-
-		if (GetActualState(package)->is_valid)
-			getMemoryTotalSpace(package->hctxRegular, 0, &regularSpace);
-		getMemoryTotalSpace(package->hctxTransact, 0, &transactSpace);
-
-		totalSpace = regularSpace + transactSpace;
-		values[1] = Int64GetDatum(totalSpace);
+		values[1] = Int64GetDatum(getPackageSpace(package));
 
 		/* Data are ready */
 		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
@@ -1200,6 +2944,97 @@ get_packages_stats(PG_FUNCTION_ARGS)
 	}
 }
 
+/*
+ * Get list of variables with the number of records, the size of their data
+ * and the number of their states. The values are kept by the variables, so
+ * memory contexts are not examined.
+ */
+Datum
+get_variables_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	Package    *package;
+	HASH_SEQ_STATUS pstat;
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	tupstore = initMaterializedResult(fcinfo, tupdesc);
+	if (!packagesHash)
+		return (Datum) 0;
+
+	hash_seq_init(&pstat, packagesHash);
+	while ((package = (Package *) hash_seq_search(&pstat)) != NULL)
+	{
+		Variable   *variable;
+		HASH_SEQ_STATUS vstat;
+		int			i;
+
+		/* Skip packages marked as deleted */
+		if (!GetActualState(package)->is_valid)
+			continue;
+
+		for (i = 0; i < 2; i++)
+		{
+			hash_seq_init(&vstat, i ? package->varHashTransact :
+						  package->varHashRegular);
+			while ((variable = (Variable *) hash_seq_search(&vstat)) != NULL)
+			{
+				Datum		values[6];
+				bool		nulls[6];
+				int64		size = 0;
+				int32		nstates = 0;
+				dlist_iter	iter;
+
+				if (!GetActualState(variable)->is_valid)
+					continue;
+
+				memset(nulls, 0, sizeof(nulls));
+				values[0] = PointerGetDatum(cstring_to_text(GetName(package)));
+				values[1] = PointerGetDatum(cstring_to_text(GetName(variable)));
+				values[2] = BoolGetDatum(variable->is_transactional);
+
+				if (variable->typid == RECORDOID)
+				{
+					RecordVar  *record = GetActualValue(variable).record;
+
+					values[3] = Int64GetDatum(count_records(record));
+					size = record->data_size;
+				}
+				else if (variable->is_array)
+				{
+					ArrayVar   *array = GetActualValue(variable).array.data;
+
+					values[3] = Int64GetDatum(array->nelems);
+					size = array->data_size;
+				}
+				else
+				{
+					ScalarVar  *scalar = &(GetActualValue(variable).scalar);
+
+					nulls[3] = true;
+					if (!scalar->is_null && !scalar->typbyval)
+						size = datumGetSize(scalar->value, false,
+											scalar->typlen);
+				}
+				values[4] = Int64GetDatum(size);
+
+				dlist_foreach(iter, GetStateStorage(variable))
+					nstates++;
+				values[5] = Int32GetDatum(nstates);
+
+				tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+			}
+		}
+	}
+
+	return (Datum) 0;
+}
+
 /*
  * Static functions
  */
@@ -1219,6 +3054,104 @@ getKeyFromName(text *name, char *key)
 	key[key_len] = '\0';
 }
 
+/*
+ * Hash of the name of a package or of a variable within the package.
+ */
+static uint32
+nameCacheHash(const char *key, Package *package)
+{
+	uint32		hash;
+
+	hash = DatumGetUInt32(hash_any((const unsigned char *) key,
+								   strlen(key)));
+	if (package)
+		hash ^= DatumGetUInt32(hash_uint32((uint32) (uintptr_t) package));
+
+	return hash;
+}
+
+static Package *
+getCachedPackage(const char *key, uint32 hash)
+{
+	NameCacheEntry *entry = &nameCache[hash % NAME_CACHE_SIZE];
+
+	if (entry->hash == hash && entry->package != NULL &&
+		entry->variable == NULL &&
+		strcmp(GetName(entry->package), key) == 0)
+	{
+		PROFILE_COUNT(PROFILE_NAME_CACHE_HITS, 1);
+		return entry->package;
+	}
+
+	PROFILE_COUNT(PROFILE_NAME_CACHE_MISSES, 1);
+	return NULL;
+}
+
+static Variable *
+getCachedVariable(Package *package, const char *key, uint32 hash)
+{
+	NameCacheEntry *entry = &nameCache[hash % NAME_CACHE_SIZE];
+
+	if (entry->hash == hash && entry->package == package &&
+		entry->variable != NULL &&
+		strcmp(GetName(entry->variable), key) == 0)
+	{
+		PROFILE_COUNT(PROFILE_NAME_CACHE_HITS, 1);
+		return entry->variable;
+	}
+
+	PROFILE_COUNT(PROFILE_NAME_CACHE_MISSES, 1);
+	return NULL;
+}
+
+/*
+ * Put a package or a variable (if 'variable' isn't NULL) into the cache.
+ */
+static void
+cacheObject(uint32 hash, Package *package, Variable *variable)
+{
+	NameCacheEntry *entry = &nameCache[hash % NAME_CACHE_SIZE];
+
+	entry->hash = hash;
+	entry->package = package;
+	entry->variable = variable;
+}
+
+/*
+ * Remove the variable or all entries of the package from the cache. The
+ * whole cache is reset if both arguments are NULL.
+ */
+static void
+invalidateNameCache(Package *package, Variable *variable)
+{
+	int			i;
+
+	nameCacheGeneration++;
+
+	for (i = 0; i < NAME_CACHE_SIZE; i++)
+	{
+		NameCacheEntry *entry = &nameCache[i];
+
+		if ((package == NULL && variable == NULL) ||
+			(variable != NULL && entry->variable == variable) ||
+			(variable == NULL && entry->package == package))
+			MemSet(entry, 0, sizeof(NameCacheEntry));
+	}
+}
+
+/*
+ * Create a context for states of objects, all of them have the same size
+ */
+static MemoryContext
+createStatesContext(MemoryContext parent, const char *name, Size size)
+{
+#if PG_VERSION_NUM >= 100000
+	return SlabContextCreate(parent, name, PGV_STATES_BLOCK_SIZE, size);
+#else
+	return AllocSetContextCreate(parent, name, ALLOCSET_START_SMALL_SIZES);
+#endif
+}
+
 static void
 ensurePackagesHashExists(void)
 {
@@ -1230,6 +3163,9 @@ ensurePackagesHashExists(void)
 	ModuleContext = AllocSetContextCreate(CacheMemoryContext,
 										  PGV_MCXT_MAIN,
 										  ALLOCSET_DEFAULT_SIZES);
+	packStatesContext = createStatesContext(ModuleContext,
+											PGV_MCXT_PACK_STATES,
+											sizeof(PackState));
 
 	ctl.keysize = NAMEDATALEN;
 	ctl.entrysize = sizeof(Package);
@@ -1246,32 +3182,46 @@ ensurePackagesHashExists(void)
 static void
 makePackHTAB(Package *package, bool is_trans)
 {
-	HASHCTL		ctl;
-	char		key[NAMEDATALEN],
-				hash_name[BUFSIZ];
-
 	if (is_trans)
+	{
 		package->hctxTransact = AllocSetContextCreate(ModuleContext,
 													  PGV_MCXT_VARS,
-													  ALLOCSET_DEFAULT_SIZES);
+													  ALLOCSET_START_SMALL_SIZES);
+		package->hctxStates = createStatesContext(package->hctxTransact,
+												  PGV_MCXT_VAR_STATES,
+												  sizeof(VarState));
+	}
 	else
 		package->hctxRegular = AllocSetContextCreate(ModuleContext,
 													 PGV_MCXT_VARS,
-													 ALLOCSET_DEFAULT_SIZES);
+													 ALLOCSET_START_SMALL_SIZES);
+
+	createVarsHash(package, is_trans, NUMVARIABLES);
+}
+
+/*
+ * Create a hash table of variables in the context of the package, presized
+ * for 'nelem' variables
+ */
+static void
+createVarsHash(Package *package, bool is_trans, long nelem)
+{
+	HASHCTL		ctl;
+	char		hash_name[BUFSIZ];
 
 	snprintf(hash_name, BUFSIZ, "%s variables hash for package \"%s\"",
-			 is_trans ? "Transactional" : "Regular", key);
+			 is_trans ? "Transactional" : "Regular", GetName(package));
 	ctl.keysize = NAMEDATALEN;
 	ctl.entrysize = sizeof(Variable);
 	ctl.hcxt = (is_trans ? package->hctxTransact : package->hctxRegular);
 
 	if (is_trans)
 		package->varHashTransact = hash_create(hash_name,
-											   NUMVARIABLES, &ctl,
+											   nelem, &ctl,
 											   HASH_ELEM | HASH_CONTEXT);
 	else
 		package->varHashRegular = hash_create(hash_name,
-											  NUMVARIABLES, &ctl,
+											  nelem, &ctl,
 											  HASH_ELEM | HASH_CONTEXT);
 }
 
@@ -1283,27 +3233,47 @@ getPackageByName(text *name, bool create, bool strict)
 	char		key[NAMEDATALEN];
 	bool		found;
 
+	uint32		hash;
+
+#if PG_VERSION_NUM >= 90600
+	/* Packages exist only in the memory of the leader backend */
+	if (IsParallelWorker())
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("variables of the backend are not available in parallel workers")));
+#endif
+
 	getKeyFromName(name, key);
 
-	if (create)
-		ensurePackagesHashExists();
+	/* Try to find a package in the cache first */
+	hash = nameCacheHash(key, NULL);
+	package = getCachedPackage(key, hash);
+	if (package)
+		found = true;
 	else
 	{
-		if (!packagesHash)
+		if (create)
+			ensurePackagesHashExists();
+		else
 		{
-			if (strict)
-				ereport(ERROR,
-						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-						 errmsg("unrecognized package \"%s\"", key)));
+			if (!packagesHash)
+			{
+				if (strict)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("unrecognized package \"%s\"", key)));
 
-			return NULL;
+				return NULL;
+			}
 		}
-	}
 
-	/* Find or create a package entry */
-	package = (Package *) hash_search(packagesHash, key,
-									  create ? HASH_ENTER : HASH_FIND,
-									  &found);
+		/* Find or create a package entry */
+		package = (Package *) hash_search(packagesHash, key,
+										  create ? HASH_ENTER : HASH_FIND,
+										  &found);
+		if (found)
+			cacheObject(hash, package, NULL);
+	}
 
 	if (found)
 	{
@@ -1323,6 +3293,7 @@ getPackageByName(text *name, bool create, bool strict)
 			}
 
 			GetActualState(package)->is_valid = true;
+			package->cacheSize = 0;
 
 			/* XXX Check is this necessary */
 
@@ -1370,42 +3341,70 @@ getPackageByName(text *name, bool create, bool strict)
 		 */
 		makePackHTAB(package, false);
 		makePackHTAB(package, true);
+		package->cacheSize = 0;
+		package->regularUsage = 0;
+		package->transactUsage = 0;
 
 		/* Initialize history */
 		dlist_init(GetStateStorage(package));
-		packState = MemoryContextAllocZero(ModuleContext, sizeof(PackState));
+		packState = MemoryContextAllocZero(packStatesContext, sizeof(PackState));
 		dlist_push_head(GetStateStorage(package), &(packState->state.node));
 		packState->state.is_valid = true;
 
 		/* Add to changes list */
 		addToChangesStack(&package->transObject, TRANS_PACKAGE);
 
+		cacheObject(hash, package, NULL);
+
 		return package;
 	}
 }
 
 /*
- * Return a pointer to existing variable.
- * Function is useful to request a value of existing variable and
- * flag 'is_transactional' of this variable is unknown.
+ * Search a variable of the package in the cache and then in both hash tables
+ * of the package.
  */
 static Variable *
-getVariableInternal(Package *package, text *name, Oid typid, bool strict)
+findVariable(Package *package, const char *key)
 {
 	Variable   *variable;
-	char		key[NAMEDATALEN];
+	uint32		hash;
 	bool		found;
 
-	getKeyFromName(name, key);
+	hash = nameCacheHash(key, package);
+	variable = getCachedVariable(package, key, hash);
+	if (variable)
+		return variable;
 
 	variable = (Variable *) hash_search(package->varHashRegular,
 										key, HASH_FIND, &found);
 	if (!found)
 		variable = (Variable *) hash_search(package->varHashTransact,
 											key, HASH_FIND, &found);
+	if (!found)
+		return NULL;
+
+	cacheObject(hash, package, variable);
+	return variable;
+}
+
+/*
+ * Return a pointer to existing variable.
+ * Function is useful to request a value of existing variable and
+ * flag 'is_transactional' of this variable is unknown.
+ */
+static Variable *
+getVariableInternal(Package *package, text *name, Oid typid, bool strict)
+{
+	Variable   *variable;
+	char		key[NAMEDATALEN];
+
+	getKeyFromName(name, key);
+
+	variable = findVariable(package, key);
 
 	/* Check variable type */
-	if (found)
+	if (variable)
 	{
 		if (variable->typid != typid)
 		{
@@ -1433,6 +3432,44 @@ getVariableInternal(Package *package, text *name, Oid typid, bool strict)
 	return variable;
 }
 
+/*
+ * Find a record variable by names of its package and the variable. Returns
+ * NULL if there is no such variable and 'strict' is false. Used by the
+ * foreign data wrapper.
+ */
+Variable *
+get_record_variable(const char *package_name, const char *var_name,
+					bool strict)
+{
+	text	   *pname = cstring_to_text(package_name),
+			   *vname = cstring_to_text(var_name);
+	Package    *package;
+	Variable   *variable = NULL;
+
+	package = getPackageByName(pname, false, strict);
+	if (package)
+	{
+		variable = getVariableInternal(package, vname, RECORDOID, strict);
+		if (variable && !GetActualState(variable)->is_valid)
+			variable = NULL;
+	}
+
+	pfree(pname);
+	pfree(vname);
+
+	return variable;
+}
+
+/*
+ * Get the current generation of the cache of names. Pointers to packages and
+ * variables obtained within the same generation are still valid.
+ */
+uint64
+get_name_cache_generation(void)
+{
+	return nameCacheGeneration;
+}
+
 /*
  * Create a variable or return a pointer to existing one.
  * Function is useful to set new value to variable and
@@ -1440,36 +3477,66 @@ getVariableInternal(Package *package, text *name, Oid typid, bool strict)
  */
 static Variable *
 createVariableInternal(Package *package, text *name, Oid typid,
-					   bool is_transactional)
+					   bool is_array, bool is_transactional)
 {
 	Variable   *variable;
-	TransObject *transObject;
 	char		key[NAMEDATALEN];
 	bool		found;
+	uint32		hash;
+
+	/* Records of cache packages are evicted regardless of transactions */
+	if (is_transactional && package->cacheSize > 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("variables of cache package \"%s\" can not be transactional",
+						GetName(package))));
 
 	getKeyFromName(name, key);
 
 	/*
-	 * Reverse check: for non-transactional variable search in regular table
-	 * and vice versa.
+	 * Arrays are kept only by array variables, a value of an array type such
+	 * as int2vector can't be stored in the scalar value.
 	 */
-	hash_search(is_transactional ?
-				package->varHashRegular : package->varHashTransact,
-				key, HASH_FIND, &found);
-	if (found)
+	if (!is_array && typid != RECORDOID && type_is_array(typid))
 		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("variable \"%s\" already created as %sTRANSACTIONAL",
-						key, is_transactional ? "NOT " : "")));
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("scalar variable \"%s\" can not have array type %s",
+						key, format_type_be(typid))));
+
+	hash = nameCacheHash(key, package);
+	variable = getCachedVariable(package, key, hash);
+	if (variable)
+		found = true;
+	else
+	{
+		/*
+		 * Reverse check: for non-transactional variable search in regular
+		 * table and vice versa.
+		 */
+		hash_search(is_transactional ?
+					package->varHashRegular : package->varHashTransact,
+					key, HASH_FIND, &found);
+		if (found)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("variable \"%s\" already created as %sTRANSACTIONAL",
+							key, is_transactional ? "NOT " : "")));
 
-	variable = (Variable *) hash_search(pack_htab(package, is_transactional),
-										key, HASH_ENTER, &found);
+		variable = (Variable *) hash_search(pack_htab(package, is_transactional),
+											key, HASH_ENTER, &found);
+	}
 	Assert(variable);
-	transObject = &variable->transObject;
 
 	/* Check variable type */
 	if (found)
 	{
+		/* The reverse check for a variable found in the cache */
+		if (variable->is_transactional != is_transactional)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("variable \"%s\" already created as %sTRANSACTIONAL",
+							key, is_transactional ? "NOT " : "")));
+
 		if (variable->typid != typid)
 		{
 			char	   *var_type = DatumGetCString(DirectFunctionCall1(regtypeout,
@@ -1480,34 +3547,42 @@ createVariableInternal(Package *package, text *name, Oid typid,
 					 errmsg("variable \"%s\" requires \"%s\" value",
 							key, var_type)));
 		}
-
-		/*
-		 * Savepoint must be created when variable changed in current
-		 * transaction. For each transaction level there should be a
-		 * corresponding savepoint. New value should be stored in a last
-		 * state.
-		 */
-		if (is_transactional &&
-			!isObjectChangedInCurrentTrans(transObject))
-		{
-			createSavepoint(transObject, TRANS_VARIABLE);
-		}
+		Assert(variable->is_array == is_array);
 	}
 	else
 	{
 		VarState   *varState;
+		Oid			elemtype = InvalidOid;
 
 		/* Variable entry was created, so initialize new variable. */
 		variable->typid = typid;
 		variable->package = package;
 		variable->is_transactional = is_transactional;
+		variable->is_array = is_array;
+		if (is_array)
+			elemtype = get_element_type(typid);
 
 		dlist_init(GetStateStorage(variable));
-		varState = MemoryContextAllocZero(pack_hctx(package, is_transactional),
+		varState = MemoryContextAllocZero(is_transactional ?
+										  package->hctxStates :
+										  package->hctxRegular,
 										  sizeof(VarState));
 
 		dlist_push_head(GetStateStorage(variable), &varState->state.node);
-		if (typid != RECORDOID)
+		if (typid == RECORDOID)
+			varState->value.record =
+				MemoryContextAllocZero(pack_hctx(package, is_transactional),
+									   sizeof(RecordVar));
+		else if (variable->is_array)
+		{
+			varState->value.array.data =
+				MemoryContextAlloc(pack_hctx(package, is_transactional),
+								   sizeof(ArrayVar));
+			init_array(varState->value.array.data, elemtype,
+					   pack_hctx(package, is_transactional),
+					   GetPackageUsage(package, is_transactional));
+		}
+		else
 		{
 			ScalarVar  *scalar = &(varState->value.scalar);
 
@@ -1517,77 +3592,140 @@ createVariableInternal(Package *package, text *name, Oid typid,
 		}
 	}
 
-	GetActualState(variable)->is_valid = true;
-	/* If it is necessary, put variable to changedVars */
-	if (is_transactional)
-		addToChangesStack(transObject, TRANS_VARIABLE);
+	cacheObject(hash, package, variable);
+
+	markVariableChanged(variable, !found);
 
 	return variable;
 }
 
+/*
+ * Prepare the variable to get a new value.
+ */
 static void
-copyValue(VarState *src, VarState *dest, Variable *destVar)
+markVariableChanged(Variable *variable, bool is_new)
 {
-	MemoryContext oldcxt,
-				destctx;
+	TransObject *transObject = &variable->transObject;
+
+	/*
+	 * Savepoint must be created when variable changed in current transaction.
+	 * For each transaction level there should be a corresponding savepoint.
+	 * New value should be stored in a last state.
+	 */
+	if (!is_new && variable->is_transactional &&
+		!isObjectChangedInCurrentTrans(transObject))
+	{
+		createSavepoint(transObject, TRANS_VARIABLE);
+	}
 
-	destctx = destVar->package->hctxTransact;
-	oldcxt = MemoryContextSwitchTo(destctx);
+	GetActualState(variable)->is_valid = true;
+	/* If it is necessary, put variable to changedVars */
+	if (variable->is_transactional)
+		addToChangesStack(transObject, TRANS_VARIABLE);
+}
 
+static void
+copyValue(VarState *src, VarState *dest, Variable *destVar)
+{
 	if (destVar->typid == RECORDOID)
-		/* copy record value */
+		/* records are shared, their changes are logged by the new state */
+		dest->value.record = src->value.record;
+	else if (destVar->is_array)
+	{
+		/* the same for elements, the new state remembers the length */
+		dest->value.array.data = src->value.array.data;
+		dest->value.array.nelems = src->value.array.data->nelems;
+	}
+	else
 	{
-		bool		found;
-		HASH_SEQ_STATUS *rstat;
-		HashRecordEntry *item_prev,
-				   *item_new;
-		RecordVar  *record_src = &src->value.record;
-		RecordVar  *record_dest = &dest->value.record;
+		/*
+		 * Scalar value is shared until it is changed. The previous state
+		 * keeps the old value if the new state gets another one.
+		 */
+		dest->value.scalar = src->value.scalar;
+	}
+}
 
-		init_record(record_dest, record_src->tupdesc, destVar);
+static void
+freeValue(VarState *varstate, Variable *variable)
+{
+	if (variable->typid == RECORDOID)
+	{
+		RecordVar  *record = varstate->value.record;
+		dlist_head *states = GetStateStorage(variable);
 
-		/* Copy previous history entry into the new one */
-		rstat = (HASH_SEQ_STATUS *) palloc0(sizeof(HASH_SEQ_STATUS));
-		hash_seq_init(rstat, record_src->rhash);
-		while ((item_prev = (HashRecordEntry *) hash_seq_search(rstat)) != NULL)
+		/* Records are shared unless it is the only state of the variable */
+		if (!dlist_has_prev(states, &varstate->state.node) &&
+			!dlist_has_next(states, &varstate->state.node))
 		{
-			HashRecordKey k;
-
-			k = item_prev->key;
-			item_new = (HashRecordEntry *) hash_search(record_dest->rhash, &k,
-													   HASH_ENTER, &found);
-			item_new->tuple = heap_copytuple(item_prev->tuple);
+			/* All records will be freed */
+			if (record->hctx)
+			{
+				SubMemoryUsage(record->usage, record->data_size);
+				MemoryContextDelete(record->hctx);
+			}
+			pfree(record);
 		}
+		else
+			free_record_changes(varstate);
 	}
-	else
-		/* copy scalar value */
+	else if (variable->is_array)
 	{
-		ScalarVar  *scalar = &dest->value.scalar;
+		dlist_head *states = GetStateStorage(variable);
 
-		*scalar = src->value.scalar;
-		if (!scalar->is_null)
-			scalar->value = datumCopy(src->value.scalar.value,
-									  scalar->typbyval, scalar->typlen);
+		/* Elements are shared unless it is the only state of the variable */
+		if (!dlist_has_prev(states, &varstate->state.node) &&
+			!dlist_has_next(states, &varstate->state.node))
+			free_array(varstate->value.array.data);
 		else
-			scalar->value = 0;
+			free_array_changes(varstate);
+	}
+	else if (varstate->value.scalar.typbyval == false &&
+			 varstate->value.scalar.is_null == false &&
+			 !isScalarValueShared(varstate, variable))
+	{
+		SubMemoryUsage(GetPackageUsage(variable->package,
+									   variable->is_transactional),
+					   datumGetSize(varstate->value.scalar.value, false,
+									varstate->value.scalar.typlen));
+		pfree(DatumGetPointer(varstate->value.scalar.value));
 	}
-
-	MemoryContextSwitchTo(oldcxt);
 }
 
-static void
-freeValue(VarState *varstate, Oid typid)
+/*
+ * Check if a pass-by-reference scalar value of the state is also used by a
+ * neighbour state of the variable. The value is copied to a new state only
+ * by reference, so adjacent states may point to the same datum.
+ */
+static bool
+isScalarValueShared(VarState *varstate, Variable *variable)
 {
-	if (typid == RECORDOID)
+	dlist_head *states = GetStateStorage(variable);
+	ScalarVar  *scalar = &varstate->value.scalar;
+	VarState   *neighbour;
+
+	Assert(!scalar->typbyval && !scalar->is_null);
+
+	if (dlist_has_prev(states, &varstate->state.node))
 	{
-		/* All records will be freed */
-		MemoryContextDelete(varstate->value.record.hctx);
+		neighbour = dlist_container(VarState, state.node,
+									dlist_prev_node(states,
+													&varstate->state.node));
+		if (!neighbour->value.scalar.is_null &&
+			neighbour->value.scalar.value == scalar->value)
+			return true;
 	}
-	else if (varstate->value.scalar.typbyval == false &&
-			 varstate->value.scalar.is_null == false)
+	if (dlist_has_next(states, &varstate->state.node))
 	{
-		pfree(DatumGetPointer(varstate->value.scalar.value));
+		neighbour = dlist_container(VarState, state.node,
+									dlist_next_node(states,
+													&varstate->state.node));
+		if (!neighbour->value.scalar.is_null &&
+			neighbour->value.scalar.value == scalar->value)
+			return true;
 	}
+
+	return false;
 }
 
 static void
@@ -1597,8 +3735,9 @@ removeState(TransObject *object, TransObjectType type, TransState *stateToDelete
 	{
 		Variable   *var = (Variable *) object;
 
-		freeValue((VarState *) stateToDelete, var->typid);
+		freeValue((VarState *) stateToDelete, var);
 	}
+	unlinkChangedState(stateToDelete);
 	dlist_delete(&stateToDelete->node);
 	pfree(stateToDelete);
 }
@@ -1613,19 +3752,19 @@ removeObject(TransObject *object, TransObjectType type)
 	{
 		Package    *package = (Package *) object;
 
-		/*
-		 * Delete a variable from the change history of the overlying
-		 * transaction level (head of 'changesStack' at this point)
-		 */
-		if (!dlist_is_empty(changesStack))
-			removeFromChangedVars(package);
 		/* Regular variables had already removed */
 		MemoryContextDelete(package->hctxTransact);
+		SubMemoryUsage(&package->transactUsage, package->transactUsage);
 		hash = packagesHash;
 	}
 	else
 		hash = ((Variable *) object)->package->varHashTransact;
 
+	if (type == TRANS_PACKAGE)
+		invalidateNameCache((Package *) object, NULL);
+	else
+		invalidateNameCache(NULL, (Variable *) object);
+
 	/* Remove all object's states */
 	while (!dlist_is_empty(&object->states))
 		removeState(object, type, GetActualState(object));
@@ -1642,21 +3781,31 @@ createSavepoint(TransObject *transObj, TransObjectType type)
 {
 	TransState *newState,
 			   *prevState;
+	instr_time	call_start;
+
+	PROFILE_START(call_start);
 
 	prevState = GetActualState(transObj);
 	if (type == TRANS_PACKAGE)
-		newState = (TransState *) MemoryContextAllocZero(ModuleContext,
+	{
+		newState = (TransState *) MemoryContextAllocZero(packStatesContext,
 														 sizeof(PackState));
+		PROFILE_COUNT(PROFILE_SAVEPOINT_BYTES, sizeof(PackState));
+	}
 	else
 	{
 		Variable   *var = (Variable *) transObj;
 
-		newState = (TransState *) MemoryContextAllocZero(var->package->hctxTransact,
+		newState = (TransState *) MemoryContextAllocZero(var->package->hctxStates,
 														 sizeof(VarState));
 		copyValue((VarState *) prevState, (VarState *) newState, var);
+		PROFILE_COUNT(PROFILE_SAVEPOINT_BYTES, sizeof(VarState));
 	}
 	dlist_push_head(&transObj->states, &newState->node);
 	newState->is_valid = prevState->is_valid;
+
+	PROFILE_COUNT(PROFILE_SAVEPOINT_STATES, 1);
+	PROFILE_END(PROFILE_SAVEPOINT, call_start);
 }
 
 /*
@@ -1674,12 +3823,26 @@ rollbackSavepoint(TransObject *object, TransObjectType type)
 		{
 			dlist_pop_head_node(&object->states);
 			pfree(state);
-			/* Restore regular vars HTAB */
-			makePackHTAB((Package *) object, false);
+
+			/*
+			 * Remove package if it was created in rolled back transaction,
+			 * its variables had already been removed. Otherwise restore
+			 * regular vars HTAB.
+			 */
+			if (dlist_is_empty(&object->states))
+				removeObject(object, TRANS_PACKAGE);
+			else
+				makePackHTAB((Package *) object, false);
 		}
 	}
 	else
 	{
+		/* Bring back changed records and elements */
+		if (((Variable *) object)->typid == RECORDOID)
+			rollback_record_changes((VarState *) state);
+		else if (((Variable *) object)->is_array)
+			rollback_array_changes((VarState *) state);
+
 		/* Remove current state */
 		removeState(object, TRANS_VARIABLE, state);
 
@@ -1709,15 +3872,31 @@ releaseSavepoint(TransObject *object, TransObjectType type)
 		/* Remove previous state */
 		nodeToDelete = dlist_next_node(states, dlist_head_node(states));
 		stateToDelete = dlist_container(TransState, node, nodeToDelete);
+		/*
+		 * Keep changed records and elements which should be brought back on
+		 * upper level
+		 */
+		if (type == TRANS_VARIABLE &&
+			((Variable *) object)->typid == RECORDOID)
+			release_record_changes((VarState *) GetActualState(object),
+								   (VarState *) stateToDelete,
+								   !dlist_has_next(states, nodeToDelete));
+		else if (type == TRANS_VARIABLE && ((Variable *) object)->is_array)
+			release_array_changes((VarState *) GetActualState(object),
+								  (VarState *) stateToDelete,
+								  !dlist_has_next(states, nodeToDelete));
 		removeState(object, type, stateToDelete);
 	}
 
 	/*
 	 * Object has no more previous states and can be completely removed if
-	 * necessary
+	 * necessary. A removed package is kept until the end of the transaction
+	 * because its variables may be in the list of changes of the parent
+	 * level; they are marked as removed when the parent level is released.
 	 */
 	if (!GetActualState(object)->is_valid &&
-		!dlist_has_next(states, dlist_head_node(states)))
+		!dlist_has_next(states, dlist_head_node(states)) &&
+		(type == TRANS_VARIABLE || GetCurrentTransactionNestLevel() == 1))
 	{
 		removeObject(object, type);
 	}
@@ -1728,6 +3907,17 @@ releaseSavepoint(TransObject *object, TransObjectType type)
 
 		state = GetActualState(object);
 		state->level--;
+
+		/* Take the place of the removed state in the list of parent level */
+		if (GetCurrentTransactionNestLevel() > 1)
+		{
+			ChangesStackNode *csn;
+
+			csn = getChangesStackNode(GetCurrentTransactionNestLevel() - 1);
+
+			dlist_push_head(type == TRANS_PACKAGE ? &csn->changedPacksList :
+							&csn->changedVarsList, &state->changed_node);
+		}
 	}
 }
 
@@ -1766,14 +3956,24 @@ isObjectChangedInUpperTrans(TransObject *object)
 }
 
 /*
- * Create a new list of variables, changed in current transaction level
+ * Return the lists of variables and packages changed at subxact level
+ * 'level', create them if the level had no changes yet. Levels below the
+ * head of the stack are never requested.
  */
-static void
-pushChangesStack(void)
+static ChangesStackNode *
+getChangesStackNode(int level)
 {
 	MemoryContext oldcxt;
 	ChangesStackNode *csn;
 
+	if (changesStack && !dlist_is_empty(changesStack))
+	{
+		csn = dlist_head_element(ChangesStackNode, node, changesStack);
+		Assert(csn->level <= level);
+		if (csn->level == level)
+			return csn;
+	}
+
 	/*
 	 * Initialize changesStack and create MemoryContext for it if not done
 	 * before.
@@ -1792,49 +3992,29 @@ pushChangesStack(void)
 	}
 	Assert(changesStack);
 	csn = palloc0(sizeof(ChangesStackNode));
-	csn->changedVarsList = palloc0(sizeof(dlist_head));
-	csn->changedPacksList = palloc0(sizeof(dlist_head));
-
-	csn->ctx = AllocSetContextCreate(changesStackContext,
-									 PGV_MCXT_STACK_NODE,
-									 ALLOCSET_START_SMALL_SIZES);
-
-	dlist_init(csn->changedVarsList);
-	dlist_init(csn->changedPacksList);
+	csn->level = level;
+	dlist_init(&csn->changedVarsList);
+	dlist_init(&csn->changedPacksList);
 	dlist_push_head(changesStack, &csn->node);
 
 	MemoryContextSwitchTo(oldcxt);
-}
-
-/*
- * Create a changesStack with the required depth.
- */
-static void
-prepareChangesStack(void)
-{
-	if (!changesStack)
-	{
-		int			level = GetCurrentTransactionNestLevel();
 
-		while (level-- > 0)
-		{
-			pushChangesStack();
-		}
-	}
+	return csn;
 }
 
 /*
- * Initialize an instance of ChangedObject datatype
+ * Check if something was changed at current subxact level
  */
-static inline ChangedObject *
-makeChangedObject(TransObject *object, MemoryContext ctx)
+static bool
+isChangesStackLevel(void)
 {
-	ChangedObject *co;
+	ChangesStackNode *csn;
 
-	co = MemoryContextAllocZero(ctx, sizeof(ChangedObject));
-	co->object = object;
+	if (!changesStack || dlist_is_empty(changesStack))
+		return false;
 
-	return co;
+	csn = dlist_head_element(ChangesStackNode, node, changesStack);
+	return csn->level == GetCurrentTransactionNestLevel();
 }
 
 /*
@@ -1844,58 +4024,31 @@ makeChangedObject(TransObject *object, MemoryContext ctx)
 static void
 addToChangesStack(TransObject *transObj, TransObjectType type)
 {
-	prepareChangesStack();
-
 	if (!isObjectChangedInCurrentTrans(transObj))
 	{
 		ChangesStackNode *csn;
-		ChangedObject *co;
+		TransState *state = GetActualState(transObj);
 
-		csn = get_actual_changes_list();
-		co = makeChangedObject(transObj, csn->ctx);
-		dlist_push_head(type == TRANS_PACKAGE ? csn->changedPacksList :
-						csn->changedVarsList, &co->node);
+		csn = getChangesStackNode(GetCurrentTransactionNestLevel());
+		state->object = transObj;
+		dlist_push_head(type == TRANS_PACKAGE ? &csn->changedPacksList :
+						&csn->changedVarsList, &state->changed_node);
 
 		/* Give this object current subxact level */
-		GetActualState(transObj)->level = GetCurrentTransactionNestLevel();
+		state->level = GetCurrentTransactionNestLevel();
 	}
 }
 
 /*
- * Remove from the changes list a deleted package
+ * Remove a state from the list of changes it belongs to, if any
  */
 static void
-removeFromChangedVars(Package *package)
+unlinkChangedState(TransState *state)
 {
-	dlist_mutable_iter var_miter,
-				pack_miter;
-	dlist_head *changedVarsList,
-			   *changedPacksList;
-
-	/* First remove corresponding variables from changedVarsList */
-	changedVarsList = get_actual_changes_list()->changedVarsList;
-	dlist_foreach_modify(var_miter, changedVarsList)
+	if (state->changed_node.next != NULL)
 	{
-		ChangedObject *co_cur = dlist_container(ChangedObject, node,
-												var_miter.cur);
-		Variable   *var = (Variable *) co_cur->object;
-
-		if (var->package == package)
-			dlist_delete(&co_cur->node);
-	}
-	/* Now remove package itself from changedPacksList */
-	changedPacksList = get_actual_changes_list()->changedPacksList;
-	dlist_foreach_modify(pack_miter, changedPacksList)
-	{
-		ChangedObject *co_cur = dlist_container(ChangedObject, node,
-												pack_miter.cur);
-		Package    *pack = (Package *) co_cur->object;
-
-		if (pack == package)
-		{
-			dlist_delete(&co_cur->node);
-			break;
-		}
+		dlist_delete(&state->changed_node);
+		state->changed_node.prev = state->changed_node.next = NULL;
 	}
 }
 
@@ -1918,8 +4071,11 @@ processChanges(Action action)
 {
 	ChangesStackNode *bottom_list;
 	int			i;
+	instr_time	call_start;
+
+	PROFILE_START(call_start);
 
-	Assert(changesStack && changesStackContext);
+	Assert(isChangesStackLevel() && changesStackContext);
 	/* List removed from stack but we still can use it */
 	bottom_list = dlist_container(ChangesStackNode, node,
 								  dlist_pop_head_node(changesStack));
@@ -1931,13 +4087,17 @@ processChanges(Action action)
 	 */
 	for (i = 1; i > -1; i--)
 	{
-		dlist_iter	iter;
+		dlist_mutable_iter iter;
 
-		dlist_foreach(iter, i ? bottom_list->changedVarsList :
-					  bottom_list->changedPacksList)
+		dlist_foreach_modify(iter, i ? &bottom_list->changedVarsList :
+							 &bottom_list->changedPacksList)
 		{
-			ChangedObject *co = dlist_container(ChangedObject, node, iter.cur);
-			TransObject *object = co->object;
+			TransState *state = dlist_container(TransState, changed_node,
+												iter.cur);
+			TransObject *object = state->object;
+
+			/* The state leaves the list, it is moved or removed below */
+			unlinkChangedState(state);
 
 			switch (action)
 			{
@@ -1962,7 +4122,7 @@ processChanges(Action action)
 					}
 
 					/* Did this object change at parent level? */
-					if (dlist_is_empty(changesStack) ||
+					if (GetCurrentTransactionNestLevel() == 1 ||
 						isObjectChangedInUpperTrans(object))
 					{
 						/* We just have to drop previous state */
@@ -1971,20 +4131,16 @@ processChanges(Action action)
 					else
 					{
 						/* Mark object as changed at parent level */
-						ChangedObject *co_new;
 						ChangesStackNode *csn;
 
-						/*
-						 * Impossible to push in upper list existing node
-						 * because it was created in another context
-						 */
-						csn = dlist_head_element(ChangesStackNode, node, changesStack);
-						co_new = makeChangedObject(object, csn->ctx);
-						dlist_push_head(i ? csn->changedVarsList :
-										csn->changedPacksList, &co_new->node);
+						csn = getChangesStackNode(GetCurrentTransactionNestLevel() - 1);
+
+						dlist_push_head(i ? &csn->changedVarsList :
+										&csn->changedPacksList,
+										&state->changed_node);
 
 						/* Change subxact level due to release */
-						GetActualState(object)->level--;
+						state->level--;
 					}
 					break;
 			}
@@ -1992,7 +4148,7 @@ processChanges(Action action)
 	}
 
 	/* Remove changes list of current level */
-	MemoryContextDelete(bottom_list->ctx);
+	pfree(bottom_list);
 	/* Remove the stack if it is empty */
 	if (dlist_is_empty(changesStack))
 	{
@@ -2005,11 +4161,14 @@ processChanges(Action action)
 		MemoryContextDelete(ModuleContext);
 		packagesHash = NULL;
 		ModuleContext = NULL;
-		LastPackage = NULL;
-		LastVariable = NULL;
+		backendUsage = 0;
+		packStatesContext = NULL;
+		invalidateNameCache(NULL, NULL);
 		changesStack = NULL;
 		changesStackContext = NULL;
 	}
+
+	PROFILE_END(PROFILE_CHANGES, call_start);
 }
 
 /*
@@ -2019,12 +4178,12 @@ static void
 pgvSubTransCallback(SubXactEvent event, SubTransactionId mySubid,
 					SubTransactionId parentSubid, void *arg)
 {
-	if (changesStack)
+	/* Nothing to do if the subtransaction didn't change any object */
+	if (isChangesStackLevel())
 	{
 		switch (event)
 		{
 			case SUBXACT_EVENT_START_SUB:
-				pushChangesStack();
 				break;
 			case SUBXACT_EVENT_COMMIT_SUB:
 				processChanges(RELEASE_SAVEPOINT);
@@ -2044,7 +4203,7 @@ pgvSubTransCallback(SubXactEvent event, SubTransactionId mySubid,
 static void
 pgvTransCallback(XactEvent event, void *arg)
 {
-	if (changesStack)
+	if (isChangesStackLevel())
 	{
 		switch (event)
 		{
@@ -2072,6 +4231,44 @@ pgvTransCallback(XactEvent event, void *arg)
 void
 _PG_init(void)
 {
+	DefineCustomBoolVariable("pg_variables.dense_records",
+							 "Store tuples of new record variables in dense blocks.",
+							 NULL,
+							 &denseRecords,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomBoolVariable("pg_variables.profile",
+							 "Collect statistics of calls of functions of pg_variables.",
+							 NULL,
+							 &profileFunctions,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pg_variables.max_memory_per_backend",
+							"Maximum memory used by variables of a backend.",
+							"Zero disables the limit.",
+							&maxMemoryPerBackend,
+							0, 0, INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pg_variables.max_memory_per_package",
+							"Maximum memory used by variables of a package.",
+							"Zero disables the limit.",
+							&maxMemoryPerPackage,
+							0, 0, INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	init_shared_variables();
+
 	RegisterXactCallback(pgvTransCallback, NULL);
 	RegisterSubXactCallback(pgvSubTransCallback, NULL);
 }
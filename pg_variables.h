@@ -20,6 +20,8 @@
 #include "utils/numeric.h"
 #include "utils/jsonb.h"
 #include "lib/ilist.h"
+#include "lib/stringinfo.h"
+#include "portability/instr_time.h"
 
 /* Accessor for the i'th attribute of tupdesc. */
 #if PG_VERSION_NUM > 100000
@@ -31,6 +33,32 @@
 /* initial number of packages hashes */
 #define NUMPACKAGES 8
 #define NUMVARIABLES 16
+/* Upper limit of presized records hash of pgv_restore() */
+#define PGV_RESTORE_MAX_PRESIZE	(1 << 22)
+
+/* Kinds of record keys which have specialized hash and match routines */
+typedef enum RecordKeyKind
+{
+	RECORD_KEY_GENERIC,
+	RECORD_KEY_INT4,
+	RECORD_KEY_INT8,
+	RECORD_KEY_UUID,
+	RECORD_KEY_TEXT
+}			RecordKeyKind;
+
+/* Type information of a column by which records are hashed */
+typedef struct RecordKeyType
+{
+	RecordKeyKind kind;
+	/* Hash function info, used only for RECORD_KEY_GENERIC keys */
+	FmgrInfo	hash_proc;
+
+	/*
+	 * Comparison function info, used only for RECORD_KEY_GENERIC keys by
+	 * hash lookups, and for all keys except integers by ordered scans
+	 */
+	FmgrInfo	cmp_proc;
+}			RecordKeyType;
 
 typedef struct RecordVar
 {
@@ -38,10 +66,41 @@ typedef struct RecordVar
 	TupleDesc	tupdesc;
 	/* Memory context for records hash table for easy memory release */
 	MemoryContext hctx;
-	/* Hash function info */
-	FmgrInfo	hash_proc;
-	/* Match function info */
-	FmgrInfo	cmp_proc;
+	/* Dense storage of tuples, NULL if tuples are separate chunks of hctx */
+	struct RecordArena *arena;
+	/* Type of the key, the first column of records */
+	RecordKeyType key_type;
+
+	/*
+	 * Entries of the records hash sorted by key. The array is built by the
+	 * first ordered scan. Entries inserted since the last ordered scan follow
+	 * 'nsorted' sorted ones, the array is forgotten when an entry is removed.
+	 */
+	struct HashRecordEntry **sorted;
+	long		nsorted;
+	long		nappended;
+	long		maxsorted;
+	bool		sorted_valid;
+
+	/* List of indexes on other columns created by pgv_create_index() */
+	struct RecordIndex *indexes;
+	/* Number of removals of entries of the records hash */
+	uint64		nremoved;
+	/* Read-only records mapped from a file, NULL for usual records */
+	struct MappedRecords *mapped;
+
+	/* Size of tuples stored in the records hash */
+	Size		data_size;
+	/* Counter of the package changed along with data_size */
+	Size	   *usage;
+
+	/*
+	 * List of records ordered from the most recently used one if the
+	 * variable belongs to a cache package. Otherwise the list contains only
+	 * records with expiration time, and it is walked round by the sweep.
+	 */
+	bool		use_lru;
+	dlist_head	list;
 }			RecordVar;
 
 typedef struct ScalarVar
@@ -50,14 +109,42 @@ typedef struct ScalarVar
 	bool		is_null;
 	bool		typbyval;
 	int16		typlen;
+	/* Time when the value expires, 0 if it never expires */
+	TimestampTz expires;
 }			ScalarVar;
 
+/* Elements of an array variable stored one after another */
+typedef struct ArrayVar
+{
+	Datum	   *values;
+	bool	   *nulls;
+	int			nelems;
+	int			maxelems;
+	Oid			elemtype;
+	int16		typlen;
+	bool		typbyval;
+	/* Total size of values of elements */
+	Size		data_size;
+	/* Counter of the package changed along with data_size */
+	Size	   *usage;
+	/* Memory context of the package, elements are its chunks */
+	MemoryContext hctx;
+}			ArrayVar;
+
 /* State of TransObject instance */
 typedef struct TransState
 {
 	dlist_node	node;
 	bool		is_valid;
 	int			level;
+
+	/*
+	 * Node of the list of changes of the subxact level 'level'. The state
+	 * moves to the list of the parent level on release of the level, the node
+	 * is detached (NULL) if the state isn't in any list.
+	 */
+	dlist_node	changed_node;
+	struct TransObject *object;
 } TransState;
 
 /* List node that stores one of the package's states */
@@ -73,8 +160,23 @@ typedef struct VarState
 	union
 	{
 		ScalarVar	scalar;
-		RecordVar	record;
+		/* Records storage is shared by all states of the variable */
+		RecordVar  *record;
+		/* Elements are shared by all states of the variable too */
+		struct
+		{
+			ArrayVar   *data;
+			/* Number of elements when the level of the state started */
+			int			nelems;
+		}			array;
 	}			value;
+
+	/*
+	 * Previous versions of the records or of the array elements changed at
+	 * the level of the state. They are brought back if the level is rolled
+	 * back. Always NULL for the first state of the variable.
+	 */
+	HTAB	   *changes;
 }			VarState;
 
 /* Transactional object */
@@ -93,6 +195,13 @@ typedef struct Package
 	/* Memory context for package variables for easy memory release */
 	MemoryContext hctxRegular,
 				hctxTransact;
+	/* States of transactional variables, a child of hctxTransact */
+	MemoryContext hctxStates;
+	/* Limit of records size of each variable of a cache package, or 0 */
+	Size		cacheSize;
+	/* Size of values stored by regular and transactional variables */
+	Size		regularUsage,
+				transactUsage;
 }			Package;
 
 /* Transactional variable */
@@ -107,30 +216,58 @@ typedef struct Variable
 	 * specified only when creating a variable.
 	 */
 	bool		is_transactional;
+	/* Elements are stored in ArrayVar, typid is the type of the array */
+	bool		is_array;
 }			Variable;
 
 typedef struct HashRecordKey
 {
 	Datum		value;
 	bool		is_null;
-	/* Hash function info */
-	FmgrInfo   *hash_proc;
-	/* Match function info */
-	FmgrInfo   *cmp_proc;
+	/* Hash of the value computed by init_record_key() */
+	uint32		hash;
+	/* Type of the hashed column */
+	RecordKeyType *type;
 }			HashRecordKey;
 
 typedef struct HashRecordEntry
 {
 	HashRecordKey key;
 	HeapTuple	tuple;
+	/* Time when the record expires, 0 if it never expires */
+	TimestampTz expires;
+	/* Node of the list of records storage, see RecordVar */
+	dlist_node	list_node;
 }			HashRecordEntry;
 
-/* Element of list with objects created, changed or removed within transaction */
-typedef struct ChangedObject
+/*
+ * Expired records stay in the records hash until the sweep removes them, so
+ * every scan of the hash has to skip them.
+ */
+#define RecordExpired(item, now) \
+	((item)->expires != 0 && (item)->expires <= (now))
+
+/* Hash index on a column of records other than the key */
+typedef struct RecordIndex
 {
-	dlist_node	node;
-	TransObject *object;
-}			ChangedObject;
+	struct RecordIndex *next;
+	AttrNumber	attnum;
+	RecordKeyType key_type;
+	HTAB	   *hash;
+}			RecordIndex;
+
+/*
+ * Entry of the index hash. Refers to entries of the records hash which have
+ * the same value of the indexed column.
+ */
+typedef struct RecordIndexEntry
+{
+	/* Value is a copy allocated in the records memory context */
+	HashRecordKey key;
+	int			nitems;
+	int			maxitems;
+	HashRecordEntry **items;
+}			RecordIndexEntry;
 
 /* Type of transactional object instance */
 typedef enum TransObjectType
@@ -139,23 +276,167 @@ typedef enum TransObjectType
 	TRANS_VARIABLE
 }			TransObjectType;
 
-/* Element of stack with 'changedVars' and 'changedPacks' list heads*/
+/*
+ * Element of stack with lists of states of variables and packages created,
+ * changed or removed at a subxact level
+ */
 typedef struct ChangesStackNode
 {
 	dlist_node	node;
-	dlist_head *changedVarsList;
-	dlist_head *changedPacksList;
-	MemoryContext ctx;
+	/* Subxact level of the changes */
+	int			level;
+	dlist_head	changedVarsList;
+	dlist_head	changedPacksList;
 }			ChangesStackNode;
 
-extern void init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable);
+extern void init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable,
+						long nelem);
 extern void check_attributes(Variable *variable, TupleDesc tupdesc);
 extern void check_record_key(Variable *variable, Oid typid);
+extern void init_record_key(HashRecordKey *key, RecordVar *record,
+							Datum value, bool is_null);
 
-extern void insert_record(Variable *variable, HeapTupleHeader tupleHeader);
+extern void insert_record(Variable *variable, HeapTupleHeader tupleHeader,
+						  TimestampTz expires);
+extern void insert_record_tuple(Variable *variable, HeapTuple srctuple,
+								TupleDesc tupdesc);
 extern bool update_record(Variable *variable, HeapTupleHeader tupleHeader);
 extern bool delete_record(Variable *variable, Datum value, bool is_null);
 
+extern void compact_records(Variable *variable);
+
+extern void dump_records(RecordVar *record, StringInfo buf);
+extern void restore_records(Variable *variable, StringInfo buf);
+
+extern void create_record_index(Variable *variable, const char *colname);
+extern RecordIndexEntry *search_record_index(Variable *variable,
+											 const char *colname, Oid typid,
+											 Datum value, bool is_null);
+
+extern HashRecordEntry **get_sorted_records(RecordVar *record, long *nentries);
+extern long search_sorted_records(RecordVar *record, Datum value, bool is_null,
+								  bool upper);
+
+extern long count_records(RecordVar *record);
+extern HeapTuple search_record(RecordVar *record, Datum value, bool is_null);
+extern void save_records(Variable *variable, const char *filename);
+extern struct MappedRecords *open_mapped_records(const char *filename,
+												TupleDesc *tupdesc);
+extern void map_records(Variable *variable, struct MappedRecords *opened,
+						TupleDesc tupdesc);
+extern bool get_mapped_record(RecordVar *record, uint64 *pos, HeapTuple tuple);
+
+extern void rollback_record_changes(VarState *state);
+extern void release_record_changes(VarState *state, VarState *prev,
+								   bool prev_is_first);
+extern void free_record_changes(VarState *state);
+
+extern void init_array(ArrayVar *array, Oid elemtype, MemoryContext hctx,
+					   Size *usage);
+extern void push_array_elem(Variable *variable, Datum value, bool is_null);
+extern Datum get_array_elem(Variable *variable, int idx, bool *is_null);
+extern void set_array_elem(Variable *variable, int idx, Datum value,
+						   bool is_null);
+extern void rollback_array_changes(VarState *state);
+extern void release_array_changes(VarState *state, VarState *prev,
+								  bool prev_is_first);
+extern void free_array_changes(VarState *state);
+extern void free_array(ArrayVar *array);
+
+/* Functions used by the foreign data wrapper */
+extern Variable *get_record_variable(const char *package_name,
+									 const char *var_name, bool strict);
+extern uint64 get_name_cache_generation(void);
+
+/* Shared variables */
+extern void init_shared_variables(void);
+
+/* Profiling of functions, see pg_variables_profile.c */
+typedef enum ProfileEvent
+{
+	PROFILE_GET,
+	PROFILE_SET,
+	PROFILE_INSERT,
+	PROFILE_SELECT,
+	PROFILE_SAVEPOINT,
+	PROFILE_CHANGES,
+	NUM_PROFILE_EVENTS
+}			ProfileEvent;
+
+typedef enum ProfileCounter
+{
+	PROFILE_NAME_CACHE_HITS,
+	PROFILE_NAME_CACHE_MISSES,
+	PROFILE_CALL_SITE_HITS,
+	PROFILE_SAVEPOINT_STATES,
+	PROFILE_SAVEPOINT_BYTES,
+	NUM_PROFILE_COUNTERS
+}			ProfileCounter;
+
+extern uint64 profileCounters[NUM_PROFILE_COUNTERS];
+extern void profile_end(ProfileEvent event, instr_time *start);
+
+/* GUC variables */
+extern bool denseRecords;
+extern bool profileFunctions;
+
+/* Size of values stored by all packages, the sum of their counters */
+extern Size backendUsage;
+
+/* Start time is zero if profiling was disabled when the call started */
+#define PROFILE_START(start) \
+do { \
+	if (profileFunctions) \
+		INSTR_TIME_SET_CURRENT(start); \
+	else \
+		INSTR_TIME_SET_ZERO(start); \
+} while(0)
+
+#define PROFILE_END(event, start) \
+do { \
+	if (!INSTR_TIME_IS_ZERO(start)) \
+		profile_end((event), &(start)); \
+} while(0)
+
+#define PROFILE_COUNT(counter, n) \
+do { \
+	if (profileFunctions) \
+		profileCounters[(counter)] += (n); \
+} while(0)
+
+#define CHECK_ARGS_FOR_NULL() \
+do { \
+	if (PG_ARGISNULL(0)) \
+		ereport(ERROR, \
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE), \
+				 errmsg("package name can not be NULL"))); \
+	if (PG_ARGISNULL(1)) \
+		ereport(ERROR, \
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE), \
+				 errmsg("variable name can not be NULL"))); \
+} while(0)
+
+/*
+ * Values of variables are accounted in a counter of the package and in the
+ * backend counter when they are stored or released, memory limits are
+ * checked against these counters.
+ */
+#define AddMemoryUsage(usage, size) \
+do { \
+	*(usage) += (size); \
+	backendUsage += (size); \
+} while(0)
+
+#define SubMemoryUsage(usage, size) \
+do { \
+	Assert(*(usage) >= (size) && backendUsage >= (size)); \
+	*(usage) -= (size); \
+	backendUsage -= (size); \
+} while(0)
+
+#define GetPackageUsage(package, is_trans) \
+	((is_trans) ? &(package)->transactUsage : &(package)->regularUsage)
+
 #define GetActualState(object) \
 	(dlist_head_element(TransState, node, &((TransObject *) object)->states))
 
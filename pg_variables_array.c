@@ -0,0 +1,401 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_variables_array.c
+ *	  Functions to work with array variables
+ *
+ * Elements of an array variable are kept in a growable buffer allocated in
+ * the memory context of the package, so an element is accessed or appended
+ * without copying the whole array. Elements are numbered from 1 as in SQL
+ * arrays.
+ *
+ * Copyright (c) 2015-2016, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "utils/datum.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+
+#include "pg_variables.h"
+
+/* Initial number of elements of the buffer */
+#define ARRAY_INIT_SIZE		8
+#define ARRAY_MAX_SIZE		((int) (MaxAllocSize / sizeof(Datum)))
+
+/*
+ * Entry of the log of changes of the state. Keeps a previous value of an
+ * element which existed before the level of the state.
+ */
+typedef struct ArrayChange
+{
+	int			idx;
+	Datum		value;
+	bool		is_null;
+}			ArrayChange;
+
+static Size
+array_elem_size(ArrayVar *array, Datum value, bool is_null)
+{
+	if (is_null)
+		return 0;
+	return datumGetSize(value, array->typbyval, array->typlen);
+}
+
+/*
+ * Copy the value into the memory context of the array. Toasted values are
+ * fetched and decompressed, the same way as values of scalar variables.
+ */
+static Datum
+copy_array_elem(ArrayVar *array, Datum value, bool is_null)
+{
+	MemoryContext oldcxt;
+
+	if (is_null)
+		return (Datum) 0;
+
+	if (array->typlen == -1)
+		value = PointerGetDatum(PG_DETOAST_DATUM(value));
+
+	oldcxt = MemoryContextSwitchTo(array->hctx);
+	value = datumCopy(value, array->typbyval, array->typlen);
+	MemoryContextSwitchTo(oldcxt);
+
+	return value;
+}
+
+/*
+ * Count the size of the element in the array and in the package.
+ */
+static void
+add_elem_size(ArrayVar *array, Datum value, bool is_null)
+{
+	Size		size = array_elem_size(array, value, is_null);
+
+	array->data_size += size;
+	AddMemoryUsage(array->usage, size);
+}
+
+static void
+sub_elem_size(ArrayVar *array, Datum value, bool is_null)
+{
+	Size		size = array_elem_size(array, value, is_null);
+
+	array->data_size -= size;
+	SubMemoryUsage(array->usage, size);
+}
+
+static void
+free_array_elem(ArrayVar *array, Datum value, bool is_null)
+{
+	if (!is_null && !array->typbyval)
+		pfree(DatumGetPointer(value));
+}
+
+/*
+ * Remove the elements starting from 'nelems'.
+ */
+static void
+truncate_array(ArrayVar *array, int nelems)
+{
+	int			i;
+
+	for (i = nelems; i < array->nelems; i++)
+	{
+		sub_elem_size(array, array->values[i], array->nulls[i]);
+		free_array_elem(array, array->values[i], array->nulls[i]);
+	}
+	if (nelems < array->nelems)
+		array->nelems = nelems;
+}
+
+/*
+ * Initialize elements storage of the variable.
+ */
+void
+init_array(ArrayVar *array, Oid elemtype, MemoryContext hctx, Size *usage)
+{
+	array->elemtype = elemtype;
+	get_typlenbyval(elemtype, &array->typlen, &array->typbyval);
+	array->hctx = hctx;
+	array->values = NULL;
+	array->nulls = NULL;
+	array->nelems = 0;
+	array->maxelems = 0;
+	array->data_size = 0;
+	array->usage = usage;
+}
+
+/*
+ * Append the value to the end of the array. Appended elements aren't logged,
+ * a rollback removes elements beyond the length at the start of the level.
+ */
+void
+push_array_elem(Variable *variable, Datum value, bool is_null)
+{
+	ArrayVar   *array = GetActualValue(variable).array.data;
+
+	Assert(variable->is_array);
+
+	if (array->nelems >= array->maxelems)
+	{
+		int			maxelems;
+
+		if (array->maxelems >= ARRAY_MAX_SIZE)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("array variable \"%s\" has too many elements",
+							GetName(variable))));
+
+		if (array->maxelems == 0)
+		{
+			maxelems = ARRAY_INIT_SIZE;
+			array->values = (Datum *)
+				MemoryContextAlloc(array->hctx, maxelems * sizeof(Datum));
+			array->nulls = (bool *)
+				MemoryContextAlloc(array->hctx, maxelems * sizeof(bool));
+		}
+		else
+		{
+			maxelems = Min(array->maxelems * 2, ARRAY_MAX_SIZE);
+			array->values = (Datum *)
+				repalloc(array->values, maxelems * sizeof(Datum));
+			array->nulls = (bool *)
+				repalloc(array->nulls, maxelems * sizeof(bool));
+		}
+		array->maxelems = maxelems;
+	}
+
+	array->values[array->nelems] = copy_array_elem(array, value, is_null);
+	array->nulls[array->nelems] = is_null;
+	add_elem_size(array, array->values[array->nelems], is_null);
+	array->nelems++;
+}
+
+/*
+ * Return the element 'idx', NULL if it is out of bounds of the array as for
+ * SQL arrays. The value points into the array.
+ */
+Datum
+get_array_elem(Variable *variable, int idx, bool *is_null)
+{
+	ArrayVar   *array = GetActualValue(variable).array.data;
+
+	Assert(variable->is_array);
+
+	if (idx < 1 || idx > array->nelems)
+	{
+		*is_null = true;
+		return (Datum) 0;
+	}
+
+	*is_null = array->nulls[idx - 1];
+	return array->values[idx - 1];
+}
+
+/*
+ * Replace the element 'idx' by a copy of the value. The element should
+ * exist. The first change of an element within the level is logged.
+ */
+void
+set_array_elem(Variable *variable, int idx, Datum value, bool is_null)
+{
+	VarState   *state = (VarState *) GetActualState(variable);
+	ArrayVar   *array = state->value.array.data;
+	Datum		newvalue;
+	bool		logged = false;
+
+	Assert(variable->is_array);
+
+	if (idx < 1 || idx > array->nelems)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("index %d is out of bounds of variable \"%s\"",
+						idx, GetName(variable))));
+	idx--;
+
+	/* Copy the value first, the old one is intact if it fails */
+	newvalue = copy_array_elem(array, value, is_null);
+
+	/*
+	 * The element existed before the level and the variable wasn't created at
+	 * this level.
+	 */
+	if (variable->is_transactional && idx < state->value.array.nelems &&
+		dlist_has_next(GetStateStorage(variable), &state->state.node))
+	{
+		ArrayChange *change;
+		bool		found;
+
+		if (state->changes == NULL)
+		{
+			HASHCTL		ctl;
+			char		hash_name[BUFSIZ];
+
+			snprintf(hash_name, BUFSIZ, "Array changes hash for variable \"%s\"",
+					 GetName(variable));
+			MemSet(&ctl, 0, sizeof(ctl));
+			ctl.keysize = sizeof(int);
+			ctl.entrysize = sizeof(ArrayChange);
+			ctl.hcxt = array->hctx;
+			state->changes = hash_create(hash_name, NUMVARIABLES, &ctl,
+										 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+		}
+
+		change = (ArrayChange *) hash_search(state->changes, &idx,
+											 HASH_ENTER, &found);
+		/* Value of the element before this level is already saved */
+		if (!found)
+		{
+			change->value = array->values[idx];
+			change->is_null = array->nulls[idx];
+			logged = true;
+		}
+	}
+
+	sub_elem_size(array, array->values[idx], array->nulls[idx]);
+	if (!logged)
+		free_array_elem(array, array->values[idx], array->nulls[idx]);
+
+	array->values[idx] = newvalue;
+	array->nulls[idx] = is_null;
+	add_elem_size(array, newvalue, is_null);
+}
+
+/*
+ * Bring back the length of the array and the elements changed at the level
+ * of the state.
+ */
+void
+rollback_array_changes(VarState *state)
+{
+	ArrayVar   *array = state->value.array.data;
+	HASH_SEQ_STATUS astat;
+	ArrayChange *change;
+
+	truncate_array(array, state->value.array.nelems);
+
+	if (state->changes == NULL)
+		return;
+
+	hash_seq_init(&astat, state->changes);
+	while ((change = (ArrayChange *) hash_seq_search(&astat)) != NULL)
+	{
+		Assert(change->idx < array->nelems);
+
+		sub_elem_size(array, array->values[change->idx],
+					  array->nulls[change->idx]);
+		free_array_elem(array, array->values[change->idx],
+						array->nulls[change->idx]);
+
+		array->values[change->idx] = change->value;
+		array->nulls[change->idx] = change->is_null;
+		add_elem_size(array, change->value, change->is_null);
+	}
+
+	hash_destroy(state->changes);
+	state->changes = NULL;
+}
+
+/*
+ * Pass the log of changes of the state to the previous state, which is going
+ * to be removed. Values saved by the previous state are older and win, values
+ * of elements appended at the previous level aren't needed. If the previous
+ * state is the first state of the variable the log isn't needed anymore.
+ */
+void
+release_array_changes(VarState *state, VarState *prev, bool prev_is_first)
+{
+	ArrayVar   *array = state->value.array.data;
+	HASH_SEQ_STATUS astat;
+	ArrayChange *change,
+			   *item;
+	bool		found;
+
+	if (prev_is_first)
+	{
+		free_array_changes(state);
+		return;
+	}
+
+	state->value.array.nelems = prev->value.array.nelems;
+
+	if (state->changes == NULL)
+	{
+		state->changes = prev->changes;
+		prev->changes = NULL;
+		return;
+	}
+
+	hash_seq_init(&astat, state->changes);
+	while ((change = (ArrayChange *) hash_seq_search(&astat)) != NULL)
+	{
+		/* The element was appended at the previous level */
+		if (change->idx >= prev->value.array.nelems)
+		{
+			free_array_elem(array, change->value, change->is_null);
+			if (prev->changes == NULL)
+				hash_search(state->changes, &change->idx, HASH_REMOVE, NULL);
+			continue;
+		}
+
+		/* The log of the state is used as is */
+		if (prev->changes == NULL)
+			continue;
+
+		item = (ArrayChange *) hash_search(prev->changes, &change->idx,
+										   HASH_ENTER, &found);
+		if (found)
+			free_array_elem(array, change->value, change->is_null);
+		else
+		{
+			item->value = change->value;
+			item->is_null = change->is_null;
+		}
+	}
+
+	if (prev->changes != NULL)
+	{
+		hash_destroy(state->changes);
+		state->changes = prev->changes;
+		prev->changes = NULL;
+	}
+}
+
+/*
+ * Release the log of changes of the state.
+ */
+void
+free_array_changes(VarState *state)
+{
+	HASH_SEQ_STATUS astat;
+	ArrayChange *change;
+
+	if (state->changes == NULL)
+		return;
+
+	hash_seq_init(&astat, state->changes);
+	while ((change = (ArrayChange *) hash_seq_search(&astat)) != NULL)
+		free_array_elem(state->value.array.data, change->value,
+						change->is_null);
+
+	hash_destroy(state->changes);
+	state->changes = NULL;
+}
+
+/*
+ * Release all elements and the array itself.
+ */
+void
+free_array(ArrayVar *array)
+{
+	truncate_array(array, 0);
+	if (array->values)
+	{
+		pfree(array->values);
+		pfree(array->nulls);
+	}
+	pfree(array);
+}
@@ -0,0 +1,577 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_variables_fdw.c
+ *	  Foreign data wrapper to scan record variables as tables
+ *
+ * Copyright (c) 2015-2016, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "access/htup_details.h"
+#include "access/reloptions.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "executor/executor.h"
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "nodes/makefuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/planmain.h"
+#include "optimizer/restrictinfo.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/clauses.h"
+#endif
+#include "utils/lsyscache.h"
+#include "utils/rel.h"
+#include "utils/timestamp.h"
+#include "utils/typcache.h"
+
+#include "pg_variables.h"
+
+PG_FUNCTION_INFO_V1(pgv_fdw_handler);
+PG_FUNCTION_INFO_V1(pgv_fdw_validator);
+
+/*
+ * Options of a foreign table:
+ *	package - name of the package
+ *	variable - name of the record variable
+ */
+#define PGV_FDW_OPTION_PACKAGE	"package"
+#define PGV_FDW_OPTION_VARIABLE	"variable"
+
+/* Planner state kept in baserel->fdw_private */
+typedef struct PgvFdwPlanState
+{
+	char	   *package;
+	char	   *variable;
+	/* Equality operator of the key column type */
+	Oid			eq_opr;
+}			PgvFdwPlanState;
+
+/* Executor state kept in node->fdw_state */
+typedef struct PgvFdwScanState
+{
+	char	   *package;
+	char	   *variable;
+	/* Value of the key to look up, NULL for a full scan */
+	ExprState  *keyexpr;
+
+	bool		started;
+	bool		done;
+	Variable   *var;
+	RecordVar  *record;
+	/* Generation of the cache of names when 'var' was found */
+	uint64		generation;
+	/* Full scan of the records hash */
+	HASH_SEQ_STATUS rstat;
+	bool		scanning;
+	uint64		nremoved;
+	/* Records expired at the start of the scan are skipped */
+	TimestampTz now;
+	/* Full scan of records mapped from a file */
+	uint64		mappedpos;
+	HeapTupleData mappedtuple;
+}			PgvFdwScanState;
+
+static void pgvGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
+								 Oid foreigntableid);
+static void pgvGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel,
+							   Oid foreigntableid);
+static ForeignScan *pgvGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
+									  Oid foreigntableid, ForeignPath *best_path,
+									  List *tlist, List *scan_clauses,
+									  Plan *outer_plan);
+static void pgvBeginForeignScan(ForeignScanState *node, int eflags);
+static TupleTableSlot *pgvIterateForeignScan(ForeignScanState *node);
+static void pgvReScanForeignScan(ForeignScanState *node);
+static void pgvEndForeignScan(ForeignScanState *node);
+
+static void getTableOptions(Oid foreigntableid, char **package,
+							char **variable);
+static Expr *getKeyClauseValue(RestrictInfo *rinfo, RelOptInfo *baserel,
+							   Oid eq_opr);
+static bool isKeyMember(PlannerInfo *root, RelOptInfo *rel,
+						EquivalenceClass *ec, EquivalenceMember *em,
+						void *arg);
+static ForeignPath *createPath(PlannerInfo *root, RelOptInfo *baserel,
+							   double rows, Cost startup_cost, Cost total_cost,
+							   Relids required_outer, List *fdw_private);
+static void startScan(ForeignScanState *node, PgvFdwScanState *state);
+static void endScan(PgvFdwScanState *state);
+
+Datum
+pgv_fdw_handler(PG_FUNCTION_ARGS)
+{
+	FdwRoutine *routine = makeNode(FdwRoutine);
+
+	routine->GetForeignRelSize = pgvGetForeignRelSize;
+	routine->GetForeignPaths = pgvGetForeignPaths;
+	routine->GetForeignPlan = pgvGetForeignPlan;
+	routine->BeginForeignScan = pgvBeginForeignScan;
+	routine->IterateForeignScan = pgvIterateForeignScan;
+	routine->ReScanForeignScan = pgvReScanForeignScan;
+	routine->EndForeignScan = pgvEndForeignScan;
+
+	PG_RETURN_POINTER(routine);
+}
+
+/*
+ * Check options of a foreign table. Options of servers, user mappings and of
+ * the wrapper aren't allowed.
+ */
+Datum
+pgv_fdw_validator(PG_FUNCTION_ARGS)
+{
+	List	   *options = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid			catalog = PG_GETARG_OID(1);
+	bool		has_package = false,
+				has_variable = false;
+	ListCell   *lc;
+
+	foreach(lc, options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (catalog == ForeignTableRelationId &&
+			strcmp(def->defname, PGV_FDW_OPTION_PACKAGE) == 0)
+			has_package = true;
+		else if (catalog == ForeignTableRelationId &&
+				 strcmp(def->defname, PGV_FDW_OPTION_VARIABLE) == 0)
+			has_variable = true;
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+					 errmsg("invalid option \"%s\"", def->defname),
+					 errhint("Valid options of foreign tables are \"%s\" and \"%s\".",
+							 PGV_FDW_OPTION_PACKAGE, PGV_FDW_OPTION_VARIABLE)));
+	}
+
+	if (catalog == ForeignTableRelationId && (!has_package || !has_variable))
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+				 errmsg("options \"%s\" and \"%s\" are required",
+						PGV_FDW_OPTION_PACKAGE, PGV_FDW_OPTION_VARIABLE)));
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * Get names of the package and the variable of a foreign table.
+ */
+static void
+getTableOptions(Oid foreigntableid, char **package, char **variable)
+{
+	ForeignTable *table = GetForeignTable(foreigntableid);
+	ListCell   *lc;
+
+	*package = NULL;
+	*variable = NULL;
+
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, PGV_FDW_OPTION_PACKAGE) == 0)
+			*package = defGetString(def);
+		else if (strcmp(def->defname, PGV_FDW_OPTION_VARIABLE) == 0)
+			*variable = defGetString(def);
+	}
+
+	if (*package == NULL || *variable == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+				 errmsg("options \"%s\" and \"%s\" are required",
+						PGV_FDW_OPTION_PACKAGE, PGV_FDW_OPTION_VARIABLE)));
+}
+
+/*
+ * Estimate the number of rows by the real number of records of the variable.
+ */
+static void
+pgvGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel,
+					 Oid foreigntableid)
+{
+	PgvFdwPlanState *fpinfo;
+	Variable   *variable;
+	double		ntuples = 0;
+	Oid			keytype;
+	TypeCacheEntry *typentry;
+
+	fpinfo = (PgvFdwPlanState *) palloc0(sizeof(PgvFdwPlanState));
+	getTableOptions(foreigntableid, &fpinfo->package, &fpinfo->variable);
+
+	keytype = get_atttype(foreigntableid, 1);
+	typentry = lookup_type_cache(keytype, TYPECACHE_EQ_OPR);
+	fpinfo->eq_opr = typentry->eq_opr;
+
+	/* The variable may not exist yet, it is checked by the executor */
+	variable = get_record_variable(fpinfo->package, fpinfo->variable, false);
+	if (variable)
+		ntuples = count_records(GetActualValue(variable).record);
+
+	baserel->tuples = ntuples;
+	baserel->rows = clamp_row_est(ntuples *
+								  clauselist_selectivity(root,
+														 baserel->baserestrictinfo,
+														 0, JOIN_INNER, NULL));
+	baserel->fdw_private = fpinfo;
+}
+
+/*
+ * If the clause is "key = expr" where expr doesn't refer to the relation,
+ * return expr.
+ */
+static Expr *
+getKeyClauseValue(RestrictInfo *rinfo, RelOptInfo *baserel, Oid eq_opr)
+{
+	OpExpr	   *op;
+	Node	   *left,
+			   *right;
+
+	if (!OidIsValid(eq_opr) || !IsA(rinfo->clause, OpExpr))
+		return NULL;
+
+	op = (OpExpr *) rinfo->clause;
+	if (op->opno != eq_opr || list_length(op->args) != 2)
+		return NULL;
+
+	left = (Node *) linitial(op->args);
+	right = (Node *) lsecond(op->args);
+
+	if (IsA(left, Var) &&
+		((Var *) left)->varno == baserel->relid &&
+		((Var *) left)->varattno == 1 &&
+		((Var *) left)->varlevelsup == 0 &&
+		!bms_is_member(baserel->relid, rinfo->right_relids) &&
+		!contain_volatile_functions(right))
+		return (Expr *) right;
+
+	if (IsA(right, Var) &&
+		((Var *) right)->varno == baserel->relid &&
+		((Var *) right)->varattno == 1 &&
+		((Var *) right)->varlevelsup == 0 &&
+		!bms_is_member(baserel->relid, rinfo->left_relids) &&
+		!contain_volatile_functions(left))
+		return (Expr *) left;
+
+	return NULL;
+}
+
+/*
+ * Callback of generate_implied_equalities_for_column() to find equivalence
+ * classes with the key column.
+ */
+static bool
+isKeyMember(PlannerInfo *root, RelOptInfo *rel, EquivalenceClass *ec,
+			EquivalenceMember *em, void *arg)
+{
+	Var		   *var = (Var *) em->em_expr;
+
+	return IsA(var, Var) &&
+		var->varno == rel->relid &&
+		var->varattno == 1 &&
+		var->varlevelsup == 0;
+}
+
+static ForeignPath *
+createPath(PlannerInfo *root, RelOptInfo *baserel, double rows,
+		   Cost startup_cost, Cost total_cost, Relids required_outer,
+		   List *fdw_private)
+{
+#if PG_VERSION_NUM >= 170000
+	return create_foreignscan_path(root, baserel, NULL, rows,
+								   startup_cost, total_cost, NIL,
+								   required_outer, NULL, NIL, fdw_private);
+#elif PG_VERSION_NUM >= 90600
+	return create_foreignscan_path(root, baserel, NULL, rows,
+								   startup_cost, total_cost, NIL,
+								   required_outer, NULL, fdw_private);
+#else
+	return create_foreignscan_path(root, baserel, rows,
+								   startup_cost, total_cost, NIL,
+								   required_outer, NULL, fdw_private);
+#endif
+}
+
+/*
+ * Add a full scan path and paths which look up a single record by the key.
+ * The key may be compared with a constant or with a column of an outer
+ * relation, the latter gives a path parameterized by the outer relation.
+ */
+static void
+pgvGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel,
+				   Oid foreigntableid)
+{
+	PgvFdwPlanState *fpinfo = (PgvFdwPlanState *) baserel->fdw_private;
+	List	   *clauses;
+	ListCell   *lc;
+
+	/* Full scan of the records hash */
+	add_path(baserel, (Path *)
+			 createPath(root, baserel, baserel->rows, 0,
+						cpu_tuple_cost * baserel->tuples, NULL, NIL));
+
+	/* Join clauses on the key may be in equivalence classes or not */
+	clauses = NIL;
+	foreach(lc, baserel->joininfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+
+		if (join_clause_is_movable_to(rinfo, baserel))
+			clauses = lappend(clauses, rinfo);
+	}
+	if (baserel->has_eclass_joins)
+		clauses = list_concat(clauses,
+							  generate_implied_equalities_for_column(root,
+																	 baserel,
+																	 isKeyMember,
+																	 NULL,
+																	 baserel->lateral_referencers));
+	clauses = list_concat(list_copy(baserel->baserestrictinfo), clauses);
+
+	foreach(lc, clauses)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		Relids		required_outer;
+
+		if (getKeyClauseValue(rinfo, baserel, fpinfo->eq_opr) == NULL)
+			continue;
+
+		required_outer = bms_difference(rinfo->clause_relids, baserel->relids);
+
+		/* Lookup in the records hash */
+		add_path(baserel, (Path *)
+				 createPath(root, baserel, 1, 0, cpu_operator_cost + cpu_tuple_cost,
+							bms_is_empty(required_outer) ? NULL : required_outer,
+							list_make1(rinfo)));
+	}
+}
+
+static ForeignScan *
+pgvGetForeignPlan(PlannerInfo *root, RelOptInfo *baserel,
+				  Oid foreigntableid, ForeignPath *best_path,
+				  List *tlist, List *scan_clauses, Plan *outer_plan)
+{
+	PgvFdwPlanState *fpinfo = (PgvFdwPlanState *) baserel->fdw_private;
+	List	   *fdw_exprs = NIL;
+	List	   *fdw_private;
+
+	if (best_path->fdw_private != NIL)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) linitial(best_path->fdw_private);
+
+		fdw_exprs = list_make1(getKeyClauseValue(rinfo, baserel,
+												 fpinfo->eq_opr));
+	}
+
+	/* All clauses are checked by the executor including the key clause */
+	scan_clauses = extract_actual_clauses(scan_clauses, false);
+
+	fdw_private = list_make2(makeString(fpinfo->package),
+							 makeString(fpinfo->variable));
+
+	return make_foreignscan(tlist, scan_clauses, baserel->relid,
+							fdw_exprs, fdw_private, NIL, NIL, outer_plan);
+}
+
+static void
+pgvBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+	PgvFdwScanState *state;
+
+	state = (PgvFdwScanState *) palloc0(sizeof(PgvFdwScanState));
+	node->fdw_state = state;
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	state->package = strVal(linitial(plan->fdw_private));
+	state->variable = strVal(lsecond(plan->fdw_private));
+	if (plan->fdw_exprs != NIL)
+		state->keyexpr = ExecInitExpr((Expr *) linitial(plan->fdw_exprs),
+									  (PlanState *) node);
+}
+
+/*
+ * Find the variable and check that the structure of its records is the same
+ * as the structure of the table.
+ */
+static void
+startScan(ForeignScanState *node, PgvFdwScanState *state)
+{
+	TupleDesc	tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+	Relation	rel = node->ss.ss_currentRelation;
+	int			i;
+
+	state->var = get_record_variable(state->package, state->variable, true);
+	state->record = GetActualValue(state->var).record;
+	state->generation = get_name_cache_generation();
+
+	if (state->record->tupdesc->natts != tupdesc->natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+				 errmsg("foreign table \"%s\" structure differs from variable \"%s\" "
+						"structure", RelationGetRelationName(rel),
+						state->variable)));
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		if (GetTupleDescAttr(state->record->tupdesc, i)->atttypid !=
+			GetTupleDescAttr(tupdesc, i)->atttypid)
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					 errmsg("foreign table \"%s\" structure differs from variable \"%s\" "
+							"structure", RelationGetRelationName(rel),
+							state->variable)));
+	}
+
+	state->started = true;
+	state->done = false;
+}
+
+static void
+endScan(PgvFdwScanState *state)
+{
+	if (state->scanning)
+	{
+		hash_seq_term(&state->rstat);
+		state->scanning = false;
+	}
+	state->started = false;
+}
+
+static TupleTableSlot *
+pgvIterateForeignScan(ForeignScanState *node)
+{
+	PgvFdwScanState *state = (PgvFdwScanState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	HeapTuple	tuple = NULL;
+	/* Lookups of mapped records return copies */
+	bool		copied = false;
+
+	ExecClearTuple(slot);
+
+	if (!state->started)
+	{
+		startScan(node, state);
+
+		if (state->keyexpr == NULL && state->record->mapped)
+			state->mappedpos = 0;
+		else if (state->keyexpr == NULL)
+		{
+			hash_seq_init(&state->rstat, state->record->rhash);
+			state->scanning = true;
+			state->nremoved = state->record->nremoved;
+			state->now = GetCurrentTimestamp();
+		}
+	}
+
+	if (state->done)
+		return slot;
+
+	if (state->keyexpr)
+	{
+		ExprContext *econtext = node->ss.ps.ps_ExprContext;
+		Datum		value;
+		bool		isnull;
+
+		/* There is at most one record with the key */
+		state->done = true;
+
+#if PG_VERSION_NUM >= 100000
+		value = ExecEvalExpr(state->keyexpr, econtext, &isnull);
+#else
+		value = ExecEvalExpr(state->keyexpr, econtext, &isnull, NULL);
+#endif
+		/* NULL is not equal to anything */
+		if (!isnull)
+		{
+			tuple = search_record(state->record, value, false);
+			copied = state->record->mapped != NULL;
+		}
+	}
+	else
+	{
+		/*
+		 * The variable may be removed or its records may be deleted by the
+		 * same query, continuing the scan is unsafe then. Inserted and
+		 * updated records may or may not be returned.
+		 */
+		if (state->generation != get_name_cache_generation())
+		{
+			if (get_record_variable(state->package, state->variable,
+									false) != state->var)
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("variable \"%s\" was removed during the scan",
+								state->variable)));
+			state->generation = get_name_cache_generation();
+		}
+		if (state->record->nremoved != state->nremoved)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("records of variable \"%s\" were deleted during "
+							"the scan", state->variable)));
+
+		if (state->record->mapped)
+		{
+			if (get_mapped_record(state->record, &state->mappedpos,
+								  &state->mappedtuple))
+				tuple = &state->mappedtuple;
+			else
+				state->done = true;
+		}
+		else
+		{
+			HashRecordEntry *item;
+
+			do
+				item = (HashRecordEntry *) hash_seq_search(&state->rstat);
+			while (item != NULL && RecordExpired(item, state->now));
+
+			if (item != NULL)
+				tuple = item->tuple;
+			else
+			{
+				/* hash_seq_search() has finished the scan */
+				state->scanning = false;
+				state->done = true;
+			}
+		}
+	}
+
+	/* The record may be changed before the slot is released */
+	if (tuple != NULL)
+	{
+		if (!copied)
+			tuple = heap_copytuple(tuple);
+#if PG_VERSION_NUM >= 120000
+		ExecStoreHeapTuple(tuple, slot, false);
+#else
+		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
+#endif
+	}
+
+	return slot;
+}
+
+static void
+pgvReScanForeignScan(ForeignScanState *node)
+{
+	endScan((PgvFdwScanState *) node->fdw_state);
+}
+
+static void
+pgvEndForeignScan(ForeignScanState *node)
+{
+	endScan((PgvFdwScanState *) node->fdw_state);
+}
@@ -0,0 +1,169 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_variables_profile.c
+ *	  Profiling of functions which work with variables
+ *
+ * Profiling is enabled by pg_variables.profile parameter. It collects numbers
+ * of calls and histograms of latencies of functions, and counters of the
+ * cache of names and of savepoints of the backend.
+ *
+ * Copyright (c) 2015-2016, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "funcapi.h"
+#include "miscadmin.h"
+
+#include "catalog/pg_type.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/tuplestore.h"
+
+#include "pg_variables.h"
+
+PG_FUNCTION_INFO_V1(get_profile);
+PG_FUNCTION_INFO_V1(reset_profile);
+
+/* Latencies of calls are counted in buckets of powers of two microseconds */
+#define PROFILE_NUM_BUCKETS	16
+
+typedef struct ProfileEventStats
+{
+	uint64		calls;
+	instr_time	total_time;
+	uint64		buckets[PROFILE_NUM_BUCKETS];
+}			ProfileEventStats;
+
+static const char *const profileEventNames[NUM_PROFILE_EVENTS] = {
+	"pgv_get",
+	"pgv_set",
+	"pgv_insert",
+	"pgv_select",
+	"savepoint",
+	"changes processing"
+};
+
+static const char *const profileCounterNames[NUM_PROFILE_COUNTERS] = {
+	"name cache hits",
+	"name cache misses",
+	"call site cache hits",
+	"savepoint states",
+	"savepoint bytes"
+};
+
+/* Collect statistics of functions and counters */
+bool		profileFunctions = false;
+
+uint64		profileCounters[NUM_PROFILE_COUNTERS];
+static ProfileEventStats profileEvents[NUM_PROFILE_EVENTS];
+
+/*
+ * Account a call of the function started at 'start'.
+ */
+void
+profile_end(ProfileEvent event, instr_time *start)
+{
+	ProfileEventStats *stats = &profileEvents[event];
+	instr_time	duration;
+	uint64		usec;
+	int			bucket = 0;
+
+	INSTR_TIME_SET_CURRENT(duration);
+	INSTR_TIME_SUBTRACT(duration, *start);
+	INSTR_TIME_ADD(stats->total_time, duration);
+	stats->calls++;
+
+	/* Bucket i counts calls which took less than 2^i microseconds */
+	usec = (uint64) INSTR_TIME_GET_MICROSEC(duration);
+	while (usec > 0 && bucket < PROFILE_NUM_BUCKETS - 1)
+	{
+		usec >>= 1;
+		bucket++;
+	}
+	stats->buckets[bucket]++;
+}
+
+/*
+ * Return collected statistics. Counters are returned as rows without time
+ * and latencies.
+ */
+Datum
+get_profile(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc	tupdesc;
+	Tuplestorestate *tupstore;
+	MemoryContext oldcontext;
+	Datum		values[4];
+	bool		nulls[4];
+	int			i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("set-valued function called in context that cannot accept a set")));
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("materialize mode required, but it is not allowed in this context")));
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("function returning record called in context "
+						"that cannot accept type record")));
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random,
+									 false, work_mem);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	memset(nulls, 0, sizeof(nulls));
+	for (i = 0; i < NUM_PROFILE_EVENTS; i++)
+	{
+		ProfileEventStats *stats = &profileEvents[i];
+		Datum		buckets[PROFILE_NUM_BUCKETS];
+		int			j;
+
+		for (j = 0; j < PROFILE_NUM_BUCKETS; j++)
+			buckets[j] = Int64GetDatum(stats->buckets[j]);
+
+		values[0] = PointerGetDatum(cstring_to_text(profileEventNames[i]));
+		values[1] = Int64GetDatum(stats->calls);
+		values[2] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(stats->total_time));
+		values[3] = PointerGetDatum(construct_array(buckets,
+													PROFILE_NUM_BUCKETS,
+													INT8OID, sizeof(int64),
+													FLOAT8PASSBYVAL, 'd'));
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	nulls[2] = nulls[3] = true;
+	for (i = 0; i < NUM_PROFILE_COUNTERS; i++)
+	{
+		values[0] = PointerGetDatum(cstring_to_text(profileCounterNames[i]));
+		values[1] = Int64GetDatum(profileCounters[i]);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
+}
+
+/*
+ * Reset collected statistics.
+ */
+Datum
+reset_profile(PG_FUNCTION_ARGS)
+{
+	memset(profileEvents, 0, sizeof(profileEvents));
+	memset(profileCounters, 0, sizeof(profileCounters));
+
+	PG_RETURN_VOID();
+}
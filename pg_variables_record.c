@@ -8,325 +8,2154 @@
  *-------------------------------------------------------------------------
  */
 #include "postgres.h"
+#include "funcapi.h"
+#include "miscadmin.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
+#include "storage/fd.h"
 #include "utils/builtins.h"
 #include "utils/datum.h"
 #include "utils/memutils.h"
+#include "utils/timestamp.h"
 #include "utils/typcache.h"
+#include "utils/uuid.h"
+
+#include "pg_variables.h"
+
+/*
+ * Dense storage of tuples.
+ *
+ * If pg_variables.dense_records is on when records storage is initialized,
+ * small tuples are packed into big blocks one after another instead of being
+ * separate chunks of the records memory context. Released tuples are put into
+ * lists of free chunks by their size and reused by new tuples of the same
+ * size. pgv_compact() moves all tuples into new blocks to get rid of holes.
+ */
+#define ARENA_BLOCK_SIZE	(64 * 1024)
+/* Bigger tuples are allocated in the memory context as usual */
+#define ARENA_MAX_CHUNK		1024
+#define ARENA_NUM_CLASSES	(ARENA_MAX_CHUNK / MAXIMUM_ALIGNOF)
+
+#define ArenaChunkSize(tuple_len)	MAXALIGN(HEAPTUPLESIZE + (tuple_len))
+#define ArenaChunkClass(size)		((size) / MAXIMUM_ALIGNOF - 1)
+
+typedef struct ArenaBlock
+{
+	struct ArenaBlock *next;
+}			ArenaBlock;
+
+#define ARENA_BLOCKHDRSZ	MAXALIGN(sizeof(ArenaBlock))
+
+typedef struct RecordArena
+{
+	/* List of allocated blocks */
+	ArenaBlock *blocks;
+	/* Free space of the last block */
+	char	   *freeptr;
+	char	   *endptr;
+	/* Lists of released chunks by size class */
+	void	   *freelists[ARENA_NUM_CLASSES];
+}			RecordArena;
+
+/* Number of records examined by one step of the sweep of expired records */
+#define SWEEP_STEP_SIZE		4
+
+/* Entry is in the list of records storage, see RecordVar */
+#define RecordInList(record, item) \
+	((record)->use_lru || (item)->expires != 0)
+
+/*
+ * Allocate a tuple which will be stored in the records hash. Only the tuple
+ * control structure is initialized.
+ */
+static HeapTuple
+alloc_record_tuple(RecordVar *record, uint32 tuple_len)
+{
+	RecordArena *arena = record->arena;
+	Size		size = ArenaChunkSize(tuple_len);
+	HeapTuple	tuple;
+
+	if (arena == NULL || size > ARENA_MAX_CHUNK)
+	{
+		tuple = (HeapTuple) MemoryContextAlloc(record->hctx,
+											   HEAPTUPLESIZE + tuple_len);
+		size = HEAPTUPLESIZE + tuple_len;
+	}
+	else if (arena->freelists[ArenaChunkClass(size)] != NULL)
+	{
+		void	  **chunk = (void **) arena->freelists[ArenaChunkClass(size)];
+
+		arena->freelists[ArenaChunkClass(size)] = *chunk;
+		tuple = (HeapTuple) chunk;
+	}
+	else
+	{
+		if (arena->freeptr + size > arena->endptr)
+		{
+			ArenaBlock *block;
+
+			block = (ArenaBlock *) MemoryContextAlloc(record->hctx,
+													  ARENA_BLOCK_SIZE);
+			block->next = arena->blocks;
+			arena->blocks = block;
+			arena->freeptr = (char *) block + ARENA_BLOCKHDRSZ;
+			arena->endptr = (char *) block + ARENA_BLOCK_SIZE;
+		}
+		tuple = (HeapTuple) arena->freeptr;
+		arena->freeptr += size;
+	}
+	record->data_size += size;
+	AddMemoryUsage(record->usage, size);
+
+	tuple->t_len = tuple_len;
+	ItemPointerSetInvalid(&(tuple->t_self));
+	tuple->t_tableOid = InvalidOid;
+	tuple->t_data = (HeapTupleHeader) ((char *) tuple + HEAPTUPLESIZE);
+
+	return tuple;
+}
+
+/*
+ * Release a tuple allocated by alloc_record_tuple().
+ */
+static void
+free_record_tuple(RecordVar *record, HeapTuple tuple)
+{
+	RecordArena *arena = record->arena;
+	Size		size = ArenaChunkSize(tuple->t_len);
+	void	  **chunk;
+
+	if (arena == NULL || size > ARENA_MAX_CHUNK)
+	{
+		record->data_size -= HEAPTUPLESIZE + tuple->t_len;
+		SubMemoryUsage(record->usage, HEAPTUPLESIZE + tuple->t_len);
+		pfree(tuple);
+		return;
+	}
+
+	record->data_size -= size;
+	SubMemoryUsage(record->usage, size);
+	chunk = (void **) tuple;
+	*chunk = arena->freelists[ArenaChunkClass(size)];
+	arena->freelists[ArenaChunkClass(size)] = chunk;
+}
+
+/*
+ * Records mapped from a file.
+ *
+ * pgv_save() writes records of a variable into a file which can be mapped
+ * into memory by pgv_map() as is. The file consists of a header, the
+ * structure of records, an open-addressed hash index and tuples. Slots of the
+ * index contain hashes of keys and offsets of tuples, so lookups probe the
+ * mapped file in place and pages of the file are shared by all processes
+ * through the page cache. Mapped records are read-only.
+ */
+#define MAPPED_MAGIC		0x5047564d
+#define MAPPED_VERSION		1
+
+typedef struct MappedHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		server_version;
+	uint32		natts;
+	uint64		nrecords;
+	/* Number of slots of the index, a power of 2 */
+	uint64		nslots;
+	uint64		attrs_off;
+	uint64		slots_off;
+	uint64		size;
+}			MappedHeader;
+
+typedef struct MappedAttr
+{
+	NameData	attname;
+	Oid			atttypid;
+	int32		atttypmod;
+	int32		attndims;
+}			MappedAttr;
+
+/* Slot of the index, zero offset means an empty slot */
+typedef struct MappedSlot
+{
+	uint32		hash;
+	uint32		len;
+	uint64		offset;
+}			MappedSlot;
+
+typedef struct MappedRecords
+{
+	char	   *base;
+	Size		size;
+	MappedHeader *header;
+	MappedSlot *slots;
+	MemoryContextCallback callback;
+}			MappedRecords;
+
+/*
+ * Raise the error if records of the variable can't be changed.
+ */
+static void
+check_record_writable(Variable *variable, RecordVar *record)
+{
+	if (record->mapped)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("variable \"%s\" is mapped from a file and can not "
+						"be changed", GetName(variable))));
+}
+
+/*
+ * Hash function for records.
+ *
+ * The hash is computed once by init_record_key() and stored in the key.
+ */
+static uint32
+record_hash(const void *key, Size keysize)
+{
+	const HashRecordKey *k = (const HashRecordKey *) key;
+
+	return k->hash;
+}
+
+/*
+ * Check equality of two text values, possibly compressed or short-headed.
+ */
+static bool
+text_key_equal(Datum value1, Datum value2)
+{
+	text	   *t1 = DatumGetTextPP(value1),
+			   *t2 = DatumGetTextPP(value2);
+	Size		len1 = VARSIZE_ANY_EXHDR(t1),
+				len2 = VARSIZE_ANY_EXHDR(t2);
+	bool		res;
+
+	res = len1 == len2 && memcmp(VARDATA_ANY(t1), VARDATA_ANY(t2), len1) == 0;
+
+	if ((Pointer) t1 != DatumGetPointer(value1))
+		pfree(t1);
+	if ((Pointer) t2 != DatumGetPointer(value2))
+		pfree(t2);
+
+	return res;
+}
+
+/*
+ * Matching function for records, to be used in hashtable lookups.
+ */
+static int
+record_match(const void *key1, const void *key2, Size keysize)
+{
+	const HashRecordKey *k1 = (const HashRecordKey *) key1;
+	const HashRecordKey *k2 = (const HashRecordKey *) key2;
+	Datum		c;
+
+	if (k1->is_null)
+	{
+		if (k2->is_null)
+			return 0;			/* NULL "=" NULL */
+		else
+			return 1;			/* NULL ">" not-NULL */
+	}
+	else if (k2->is_null)
+		return -1;				/* not-NULL "<" NULL */
+
+	/* Dynahash requires only equality */
+	switch (k1->type->kind)
+	{
+		case RECORD_KEY_INT4:
+			return DatumGetInt32(k1->value) != DatumGetInt32(k2->value);
+		case RECORD_KEY_INT8:
+			return DatumGetInt64(k1->value) != DatumGetInt64(k2->value);
+		case RECORD_KEY_UUID:
+			return memcmp(DatumGetUUIDP(k1->value), DatumGetUUIDP(k2->value),
+						  UUID_LEN) != 0;
+		case RECORD_KEY_TEXT:
+			return !text_key_equal(k1->value, k2->value);
+		default:
+			break;
+	}
+
+	c = FunctionCall2Coll(&k1->type->cmp_proc, DEFAULT_COLLATION_OID,
+						  k1->value, k2->value);
+	return DatumGetInt32(c);
+}
+
+/*
+ * Initialize a key of the records hash or of an index hash and compute its
+ * hash.
+ *
+ * We use specialized routines for the most common key types, other types use
+ * the element type's default hash opclass, and the default collation if the
+ * type is collation-sensitive.
+ */
+static void
+init_hash_key(HashRecordKey *key, RecordKeyType *type, Datum value,
+			  bool is_null)
+{
+	key->value = value;
+	key->is_null = is_null;
+	key->type = type;
+
+	if (is_null)
+	{
+		key->hash = 0;
+		return;
+	}
+
+	switch (type->kind)
+	{
+		case RECORD_KEY_INT4:
+			key->hash = DatumGetUInt32(hash_uint32((uint32) DatumGetInt32(value)));
+			break;
+		case RECORD_KEY_INT8:
+			{
+				uint64		val = (uint64) DatumGetInt64(value);
+
+				key->hash = DatumGetUInt32(hash_uint32((uint32) val ^
+													   (uint32) (val >> 32)));
+				break;
+			}
+		case RECORD_KEY_UUID:
+			key->hash = DatumGetUInt32(hash_any((unsigned char *) DatumGetUUIDP(value),
+												UUID_LEN));
+			break;
+		case RECORD_KEY_TEXT:
+			{
+				text	   *t = DatumGetTextPP(value);
+
+				key->hash = DatumGetUInt32(hash_any((unsigned char *) VARDATA_ANY(t),
+													VARSIZE_ANY_EXHDR(t)));
+				if ((Pointer) t != DatumGetPointer(value))
+					pfree(t);
+				break;
+			}
+		default:
+			key->hash = DatumGetUInt32(FunctionCall1Coll(&type->hash_proc,
+														 DEFAULT_COLLATION_OID,
+														 value));
+			break;
+	}
+}
+
+/*
+ * Initialize a key of the records hash and compute its hash.
+ */
+void
+init_record_key(HashRecordKey *key, RecordVar *record, Datum value,
+				bool is_null)
+{
+	init_hash_key(key, &record->key_type, value, is_null);
+}
+
+/*
+ * Create a hash table for records of the variable or for the log of their
+ * changes.
+ */
+static HTAB *
+create_record_hash(RecordVar *record, const char *hash_name, long nelem)
+{
+	HASHCTL		ctl;
+
+	ctl.keysize = sizeof(HashRecordKey);
+	ctl.entrysize = sizeof(HashRecordEntry);
+	ctl.hcxt = record->hctx;
+	ctl.hash = record_hash;
+	ctl.match = record_match;
+
+	return hash_create(hash_name, nelem, &ctl,
+					   HASH_ELEM | HASH_CONTEXT |
+					   HASH_FUNCTION | HASH_COMPARE);
+}
+
+/*
+ * Remember the version of the record which it had before current transaction
+ * level along with its expiration time. NULL 'oldtuple' means that there
+ * wasn't such record. Returns true if 'oldtuple' is kept in the log of changes
+ * and shouldn't be freed by caller.
+ *
+ * Only the first change of the record within the level is logged, the
+ * following changes are applied to the records hash in place.
+ */
+static bool
+save_record_change(Variable *variable, HashRecordKey *key, HeapTuple oldtuple,
+				   TimestampTz oldexpires)
+{
+	VarState   *state;
+	RecordVar  *record;
+	HashRecordEntry *change;
+	bool		found;
+	MemoryContext oldcxt;
+
+	if (!variable->is_transactional)
+		return false;
+
+	state = (VarState *) GetActualState(variable);
+	/* Variable was created at this level and there is nothing to restore */
+	if (!dlist_has_next(GetStateStorage(variable), &state->state.node))
+		return false;
+
+	record = state->value.record;
+	if (state->changes == NULL)
+	{
+		char		hash_name[BUFSIZ];
+
+		snprintf(hash_name, BUFSIZ, "Records changes hash for variable \"%s\"",
+				 GetName(variable));
+		state->changes = create_record_hash(record, hash_name, NUMVARIABLES);
+	}
+
+	change = (HashRecordEntry *)
+		hash_search_with_hash_value(state->changes, key, key->hash,
+									HASH_ENTER, &found);
+	/* Version of the record before this level is already saved */
+	if (found)
+		return false;
+
+	change->tuple = oldtuple;
+	change->expires = oldexpires;
+	if (oldtuple)
+		/* Key value should point into the saved tuple */
+		change->key.value = fastgetattr(oldtuple, 1, record->tupdesc,
+										&change->key.is_null);
+	else if (!key->is_null)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(record->tupdesc, 0);
+
+		/* The new record may be released before the level ends */
+		oldcxt = MemoryContextSwitchTo(record->hctx);
+		change->key.value = datumCopy(key->value, attr->attbyval,
+									  attr->attlen);
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	return true;
+}
+
+/*
+ * Release an entry of the log of changes.
+ */
+static void
+free_record_change(RecordVar *record, HashRecordEntry *change)
+{
+	if (change->tuple)
+		free_record_tuple(record, change->tuple);
+	else if (!change->key.is_null &&
+			 !GetTupleDescAttr(record->tupdesc, 0)->attbyval)
+		pfree(DatumGetPointer(change->key.value));
+}
+
+/*
+ * Compare two record keys in the order of the key type's default btree
+ * opclass. NULL key is greater than any other key.
+ */
+static int
+compare_record_keys(RecordVar *record, Datum value1, bool is_null1,
+					Datum value2, bool is_null2)
+{
+	if (is_null1)
+		return is_null2 ? 0 : 1;
+	else if (is_null2)
+		return -1;
+
+	switch (record->key_type.kind)
+	{
+		case RECORD_KEY_INT4:
+			if (DatumGetInt32(value1) == DatumGetInt32(value2))
+				return 0;
+			return DatumGetInt32(value1) < DatumGetInt32(value2) ? -1 : 1;
+		case RECORD_KEY_INT8:
+			if (DatumGetInt64(value1) == DatumGetInt64(value2))
+				return 0;
+			return DatumGetInt64(value1) < DatumGetInt64(value2) ? -1 : 1;
+		default:
+			break;
+	}
+
+	return DatumGetInt32(FunctionCall2Coll(&record->key_type.cmp_proc,
+										   DEFAULT_COLLATION_OID,
+										   value1, value2));
+}
+
+static int
+sorted_entry_cmp(const void *a, const void *b, void *arg)
+{
+	const HashRecordEntry *e1 = *(HashRecordEntry *const *) a;
+	const HashRecordEntry *e2 = *(HashRecordEntry *const *) b;
+
+	return compare_record_keys((RecordVar *) arg,
+							   e1->key.value, e1->key.is_null,
+							   e2->key.value, e2->key.is_null);
+}
+
+/*
+ * Sort entries appended to the sorted array since the last ordered scan and
+ * merge them with the sorted entries. The merge goes from the end of the
+ * array, so each sorted entry is moved at most once.
+ */
+static void
+merge_appended_records(RecordVar *record)
+{
+	HashRecordEntry **sorted = record->sorted;
+	HashRecordEntry **appended;
+	long		i = record->nsorted - 1,
+				j = record->nappended - 1,
+				k = record->nsorted + record->nappended - 1;
+
+	appended = (HashRecordEntry **)
+		palloc_extended(record->nappended * sizeof(HashRecordEntry *),
+						MCXT_ALLOC_HUGE);
+	memcpy(appended, sorted + record->nsorted,
+		   record->nappended * sizeof(HashRecordEntry *));
+	qsort_arg(appended, record->nappended, sizeof(HashRecordEntry *),
+			  sorted_entry_cmp, record);
+
+	while (j >= 0)
+	{
+		if (i >= 0 && sorted_entry_cmp(&sorted[i], &appended[j], record) > 0)
+			sorted[k--] = sorted[i--];
+		else
+			sorted[k--] = appended[j--];
+	}
+
+	record->nsorted += record->nappended;
+	record->nappended = 0;
+	pfree(appended);
+}
+
+/*
+ * Get entries of the records hash sorted by key. The sorted array is built at
+ * the first call. Inserted records are appended to it and merged by the next
+ * call, a removal of a record makes the next call build the array again, so
+ * changes of records never move the whole array.
+ */
+HashRecordEntry **
+get_sorted_records(RecordVar *record, long *nentries)
+{
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	long		n;
+
+	if (record->sorted_valid)
+	{
+		if (record->nappended > 0)
+			merge_appended_records(record);
+		*nentries = record->nsorted;
+		return record->sorted;
+	}
+
+	if (record->mapped)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("ordered scans of records mapped from a file are not supported")));
+
+	/* Integer keys are compared without function calls */
+	if (!OidIsValid(record->key_type.cmp_proc.fn_oid) &&
+		record->key_type.kind != RECORD_KEY_INT4 &&
+		record->key_type.kind != RECORD_KEY_INT8)
+	{
+		Oid			keyid = GetTupleDescAttr(record->tupdesc, 0)->atttypid;
+		TypeCacheEntry *typentry;
+
+		typentry = lookup_type_cache(keyid, TYPECACHE_CMP_PROC_FINFO);
+		if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify a comparison function for type %s",
+							format_type_be(keyid))));
+
+		fmgr_info_cxt(typentry->cmp_proc_finfo.fn_oid,
+					  &record->key_type.cmp_proc, record->hctx);
+	}
+
+	n = hash_get_num_entries(record->rhash);
+	if (record->sorted == NULL || record->maxsorted < n)
+	{
+		if (record->sorted)
+			pfree(record->sorted);
+		record->maxsorted = Max(n, NUMVARIABLES);
+		record->sorted = (HashRecordEntry **)
+			MemoryContextAlloc(record->hctx,
+							   record->maxsorted * sizeof(HashRecordEntry *));
+	}
+
+	record->nsorted = 0;
+	record->nappended = 0;
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		record->sorted[record->nsorted++] = item;
+
+	qsort_arg(record->sorted, record->nsorted, sizeof(HashRecordEntry *),
+			  sorted_entry_cmp, record);
+	record->sorted_valid = true;
+
+	*nentries = record->nsorted;
+	return record->sorted;
+}
+
+/*
+ * Find the position of the first sorted entry whose key is greater than or
+ * equal to 'value', or only greater if 'upper' is true. get_sorted_records()
+ * should be called before.
+ */
+long
+search_sorted_records(RecordVar *record, Datum value, bool is_null,
+					  bool upper)
+{
+	long		lo = 0,
+				hi = record->nsorted;
+
+	Assert(record->sorted_valid && record->nappended == 0);
+
+	while (lo < hi)
+	{
+		long		mid = lo + (hi - lo) / 2;
+		HashRecordEntry *item = record->sorted[mid];
+		int			c;
+
+		c = compare_record_keys(record, item->key.value, item->key.is_null,
+								value, is_null);
+		if (c < 0 || (upper && c == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Append a new entry of the records hash to the sorted array if it is built.
+ * The entry is put into its place by the next ordered scan.
+ */
+static void
+add_sorted_record(RecordVar *record, HashRecordEntry *item)
+{
+	if (!record->sorted_valid)
+		return;
+
+	if (record->nsorted + record->nappended == record->maxsorted)
+	{
+		record->maxsorted *= 2;
+		record->sorted = (HashRecordEntry **)
+			repalloc_huge(record->sorted,
+						  record->maxsorted * sizeof(HashRecordEntry *));
+	}
+
+	record->sorted[record->nsorted + record->nappended++] = item;
+}
+
+/*
+ * Forget the sorted array when an entry is removed from the records hash.
+ * The entry may be reused by the hash, so the array is built again by the
+ * next ordered scan.
+ */
+static void
+remove_sorted_record(RecordVar *record)
+{
+	record->sorted_valid = false;
+}
+
+/*
+ * Add an entry of the records hash to the index.
+ */
+static void
+add_index_item(RecordVar *record, RecordIndex *index, HashRecordEntry *item)
+{
+	Datum		value;
+	bool		isnull;
+	HashRecordKey k;
+	RecordIndexEntry *entry;
+	bool		found;
+	MemoryContext oldcxt;
+
+	value = fastgetattr(item->tuple, index->attnum, record->tupdesc, &isnull);
+	init_hash_key(&k, &index->key_type, value, isnull);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	entry = (RecordIndexEntry *)
+		hash_search_with_hash_value(index->hash, &k, k.hash,
+									HASH_ENTER, &found);
+	if (!found)
+	{
+		/* Index keys don't depend on lifetime of tuples */
+		if (!isnull)
+		{
+			Form_pg_attribute attr = GetTupleDescAttr(record->tupdesc,
+													  index->attnum - 1);
+
+			entry->key.value = datumCopy(value, attr->attbyval, attr->attlen);
+		}
+		entry->nitems = 0;
+		entry->maxitems = 4;
+		entry->items = (HashRecordEntry **)
+			palloc(entry->maxitems * sizeof(HashRecordEntry *));
+	}
+	else if (entry->nitems == entry->maxitems)
+	{
+		entry->maxitems *= 2;
+		entry->items = (HashRecordEntry **)
+			repalloc(entry->items, entry->maxitems * sizeof(HashRecordEntry *));
+	}
+
+	entry->items[entry->nitems++] = item;
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Remove an entry of the records hash from the index. The entry's tuple
+ * should be still valid.
+ */
+static void
+remove_index_item(RecordVar *record, RecordIndex *index, HashRecordEntry *item)
+{
+	Datum		value;
+	bool		isnull;
+	HashRecordKey k;
+	RecordIndexEntry *entry;
+	bool		found;
+	int			i;
+
+	value = fastgetattr(item->tuple, index->attnum, record->tupdesc, &isnull);
+	init_hash_key(&k, &index->key_type, value, isnull);
+
+	entry = (RecordIndexEntry *)
+		hash_search_with_hash_value(index->hash, &k, k.hash,
+									HASH_FIND, &found);
+	Assert(found);
+	if (!found)
+		return;
+
+	for (i = 0; i < entry->nitems; i++)
+	{
+		if (entry->items[i] == item)
+		{
+			entry->items[i] = entry->items[--entry->nitems];
+			break;
+		}
+	}
+
+	if (entry->nitems == 0)
+	{
+		HashRecordEntry **items = entry->items;
+		Datum		keyvalue = entry->key.value;
+
+		hash_search_with_hash_value(index->hash, &k, k.hash,
+									HASH_REMOVE, NULL);
+		pfree(items);
+		if (!isnull &&
+			!GetTupleDescAttr(record->tupdesc, index->attnum - 1)->attbyval)
+			pfree(DatumGetPointer(keyvalue));
+	}
+}
+
+/*
+ * Add an entry of the records hash to all indexes of the records.
+ */
+static void
+index_record(RecordVar *record, HashRecordEntry *item)
+{
+	RecordIndex *index;
+
+	for (index = record->indexes; index != NULL; index = index->next)
+		add_index_item(record, index, item);
+}
+
+/*
+ * Remove an entry of the records hash from all indexes of the records.
+ */
+static void
+unindex_record(RecordVar *record, HashRecordEntry *item)
+{
+	RecordIndex *index;
+
+	for (index = record->indexes; index != NULL; index = index->next)
+		remove_index_item(record, index, item);
+}
+
+/*
+ * Get hash and match functions for a type of hashed column. Function infos
+ * are allocated in the current memory context.
+ */
+static void
+init_key_type(RecordKeyType *type, Oid typid)
+{
+	TypeCacheEntry *typentry;
+
+	switch (typid)
+	{
+		case INT4OID:
+			type->kind = RECORD_KEY_INT4;
+			break;
+		case INT8OID:
+			type->kind = RECORD_KEY_INT8;
+			break;
+		case UUIDOID:
+			type->kind = RECORD_KEY_UUID;
+			break;
+		case TEXTOID:
+		case VARCHAROID:
+			/* Equality of these types is the equality of bytes */
+			type->kind = RECORD_KEY_TEXT;
+			break;
+		default:
+			type->kind = RECORD_KEY_GENERIC;
+			break;
+	}
+
+	if (type->kind != RECORD_KEY_GENERIC)
+		return;
+
+	typentry = lookup_type_cache(typid,
+								 TYPECACHE_HASH_PROC_FINFO |
+								 TYPECACHE_CMP_PROC_FINFO);
+
+	if (!OidIsValid(typentry->hash_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a hash function for type %s",
+						format_type_be(typid))));
+
+	if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_FUNCTION),
+				 errmsg("could not identify a matching function for type %s",
+						format_type_be(typid))));
+
+	fmgr_info(typentry->hash_proc_finfo.fn_oid, &type->hash_proc);
+	fmgr_info(typentry->cmp_proc_finfo.fn_oid, &type->cmp_proc);
+}
+
+/*
+ * Initialize records storage of the variable. 'nelem' is an estimated number
+ * of records.
+ */
+void
+init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable,
+			long nelem)
+{
+	char		hash_name[BUFSIZ];
+	MemoryContext oldcxt,
+				topctx;
+
+	Assert(variable->typid == RECORDOID);
+
+	sprintf(hash_name, "Records hash for variable \"%s\"", GetName(variable));
+
+	topctx = variable->is_transactional ?
+		variable->package->hctxTransact :
+		variable->package->hctxRegular;
+
+	/* Start with small blocks, most of variables hold a few records */
+#if PG_VERSION_NUM >= 110000
+	record->hctx = AllocSetContextCreateExtended(topctx,
+												 hash_name,
+												 ALLOCSET_SMALL_MINSIZE,
+												 ALLOCSET_SMALL_INITSIZE,
+												 ALLOCSET_DEFAULT_MAXSIZE);
+#else
+	record->hctx = AllocSetContextCreate(topctx,
+										 hash_name,
+										 ALLOCSET_SMALL_MINSIZE,
+										 ALLOCSET_SMALL_INITSIZE,
+										 ALLOCSET_DEFAULT_MAXSIZE);
+#endif
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+	record->tupdesc = CreateTupleDescCopyConstr(tupdesc);
+	record->arena = denseRecords ? palloc0(sizeof(RecordArena)) : NULL;
+	record->data_size = 0;
+	record->usage = GetPackageUsage(variable->package,
+									variable->is_transactional);
+	record->use_lru = variable->package->cacheSize > 0 &&
+		!variable->is_transactional;
+	dlist_init(&record->list);
+
+	/* Initialize hash table. */
+	record->rhash = create_record_hash(record, hash_name,
+									   Max(nelem, NUMVARIABLES));
+
+	/* Get hash and match functions for key type. */
+	init_key_type(&record->key_type,
+				  GetTupleDescAttr(record->tupdesc, 0)->atttypid);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * New record structure should be the same as the first record.
+ */
+void
+check_attributes(Variable *variable, TupleDesc tupdesc)
+{
+	int			i;
+	RecordVar  *record;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	/* First, check columns count. */
+	if (record->tupdesc->natts != tupdesc->natts)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("new record structure differs from variable \"%s\" "
+						"structure", GetName(variable))));
+
+	/* Second, check columns type. */
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr1 = GetTupleDescAttr(record->tupdesc, i),
+					attr2 = GetTupleDescAttr(tupdesc, i);
+
+		if ((attr1->atttypid != attr2->atttypid)
+			|| (attr1->attndims != attr2->attndims)
+			|| (attr1->atttypmod != attr2->atttypmod))
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("new record structure differs from variable \"%s\" "
+							"structure", GetName(variable))));
+	}
+}
+
+/*
+ * Check record key type. If not same then throw a error.
+ */
+void
+check_record_key(Variable *variable, Oid typid)
+{
+	RecordVar  *record;
+
+	Assert(variable->typid == RECORDOID);
+	record = GetActualValue(variable).record;
+
+	if (GetTupleDescAttr(record->tupdesc, 0)->atttypid != typid)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("requested value type differs from variable \"%s\" "
+						"key type", GetName(variable))));
+}
+
+/*
+ * Forget the entry removed from the records hash. The record is kept in the
+ * log of changes if it is needed by a rollback.
+ */
+static void
+forget_record(Variable *variable, RecordVar *record, HashRecordEntry *item)
+{
+	record->nremoved++;
+	remove_sorted_record(record);
+	unindex_record(record, item);
+	if (RecordInList(record, item))
+		dlist_delete(&item->list_node);
+	if (!save_record_change(variable, &item->key, item->tuple, item->expires))
+		free_record_tuple(record, item->tuple);
+}
+
+/*
+ * Release least recently used records of a variable of a cache package until
+ * the size of its records fits into the limit of the package. The most
+ * recently used record is always kept.
+ */
+static void
+evict_records(Variable *variable, RecordVar *record)
+{
+	Size		limit = variable->package->cacheSize;
+
+	while (record->data_size > limit &&
+		   dlist_head_node(&record->list) != dlist_tail_node(&record->list))
+	{
+		HashRecordEntry *item;
+
+		item = dlist_tail_element(HashRecordEntry, list_node, &record->list);
+		hash_search_with_hash_value(record->rhash, &item->key, item->key.hash,
+									HASH_REMOVE, NULL);
+		forget_record(variable, record, item);
+	}
+}
+
+/*
+ * Make a step of the sweep of expired records. Only a few records from the
+ * tail of the list are examined, so that big variables never make a pause.
+ * Records which are not expired yet are moved to the head of the list, except
+ * records of cache packages whose order is kept.
+ */
+static void
+sweep_records(Variable *variable, RecordVar *record)
+{
+	TimestampTz now = 0;
+	int			i;
+
+	for (i = 0; i < SWEEP_STEP_SIZE && !dlist_is_empty(&record->list); i++)
+	{
+		HashRecordEntry *item;
+
+		item = dlist_tail_element(HashRecordEntry, list_node, &record->list);
+		if (item->expires == 0)
+			break;
+		if (now == 0)
+			now = GetCurrentTimestamp();
+
+		if (item->expires > now)
+		{
+			if (record->use_lru)
+				break;
+			dlist_move_head(&record->list, &item->list_node);
+			continue;
+		}
+
+		hash_search_with_hash_value(record->rhash, &item->key, item->key.hash,
+									HASH_REMOVE, NULL);
+		forget_record(variable, record, item);
+	}
+}
+
+/*
+ * Put a tuple allocated in the records memory context into the records hash.
+ * The record expires at 'expires' unless it is 0.
+ */
+static void
+insert_record_internal(Variable *variable, RecordVar *record, HeapTuple tuple,
+					   TimestampTz expires)
+{
+	Datum		value;
+	bool		isnull;
+	HashRecordKey k;
+	HashRecordEntry *item;
+	bool		found;
+
+	sweep_records(variable, record);
+
+	/* Inserting a new record */
+	value = fastgetattr(tuple, 1, record->tupdesc, &isnull);
+	/* First, check if there is a record with same key */
+	init_record_key(&k, record, value, isnull);
+
+	item = (HashRecordEntry *)
+		hash_search_with_hash_value(record->rhash, &k, k.hash,
+									HASH_ENTER, &found);
+	if (found && RecordExpired(item, GetCurrentTimestamp()))
+	{
+		/* Expired record is replaced as if it was missing */
+		remove_sorted_record(record);
+		unindex_record(record, item);
+		if (RecordInList(record, item))
+			dlist_delete(&item->list_node);
+		if (!save_record_change(variable, &item->key, item->tuple,
+								item->expires))
+			free_record_tuple(record, item->tuple);
+		item->key = k;
+		found = false;
+	}
+	else if (found)
+	{
+		free_record_tuple(record, tuple);
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("there is a record in the variable \"%s\" with same "
+						"key", GetName(variable))));
+	}
+	/* Second, insert a new record */
+	item->tuple = tuple;
+	item->expires = expires;
+	add_sorted_record(record, item);
+	index_record(record, item);
+	/* The record didn't exist before current savepoint */
+	save_record_change(variable, &k, NULL, 0);
+
+	if (RecordInList(record, item))
+		dlist_push_head(&record->list, &item->list_node);
+	if (record->use_lru)
+		evict_records(variable, record);
+}
+
+/*
+ * Insert a new record. New record key should be unique in the variable. The
+ * record expires at 'expires' unless it is 0.
+ */
+void
+insert_record(Variable *variable, HeapTupleHeader tupleHeader,
+			  TimestampTz expires)
+{
+	HeapTuple	tuple;
+	int			tuple_len;
+	RecordVar  *record;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	/* Build a HeapTuple control structure */
+	tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+
+	tuple = alloc_record_tuple(record, tuple_len);
+	memcpy((char *) tuple->t_data, (char *) tupleHeader, tuple_len);
+
+	insert_record_internal(variable, record, tuple, expires);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Insert a new record from a tuple returned by a query. The tuple is stored
+ * in the form of composite datum, the same way as insert_record() does.
+ * 'tupdesc' should be blessed.
+ */
+void
+insert_record_tuple(Variable *variable, HeapTuple srctuple, TupleDesc tupdesc)
+{
+	HeapTuple	tuple;
+	HeapTupleHeader tupleHeader = NULL;
+	int			tuple_len;
+	RecordVar  *record;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	/* Out-of-line values can't be stored within composite datum */
+	if (HeapTupleHasExternal(srctuple))
+	{
+		tupleHeader = DatumGetHeapTupleHeader(heap_copy_tuple_as_datum(srctuple,
+																	   tupdesc));
+		tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+	}
+	else
+		tuple_len = srctuple->t_len;
+
+	/* Build a HeapTuple control structure */
+	tuple = alloc_record_tuple(record, tuple_len);
+	if (tupleHeader)
+	{
+		memcpy((char *) tuple->t_data, (char *) tupleHeader, tuple_len);
+		pfree(tupleHeader);
+	}
+	else
+	{
+		memcpy((char *) tuple->t_data, (char *) srctuple->t_data, tuple_len);
+		HeapTupleHeaderSetDatumLength(tuple->t_data, tuple_len);
+		HeapTupleHeaderSetTypeId(tuple->t_data, tupdesc->tdtypeid);
+		HeapTupleHeaderSetTypMod(tuple->t_data, tupdesc->tdtypmod);
+	}
+
+	insert_record_internal(variable, record, tuple, 0);
+
+	MemoryContextSwitchTo(oldcxt);
+}
+
+/*
+ * Insert a record. New record key should be unique in the variable.
+ */
+bool
+update_record(Variable *variable, HeapTupleHeader tupleHeader)
+{
+	TupleDesc	tupdesc;
+	HeapTuple	tuple;
+	int			tuple_len;
+	Datum		value;
+	bool		isnull;
+	RecordVar  *record;
+	HashRecordKey k;
+	HashRecordEntry *item;
+	bool		found;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	oldcxt = MemoryContextSwitchTo(record->hctx);
+
+	tupdesc = record->tupdesc;
+
+	/* Build a HeapTuple control structure */
+	tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+
+	tuple = alloc_record_tuple(record, tuple_len);
+	memcpy((char *) tuple->t_data, (char *) tupleHeader, tuple_len);
+
+	/* Update a record */
+	value = fastgetattr(tuple, 1, tupdesc, &isnull);
+	init_record_key(&k, record, value, isnull);
+
+	item = (HashRecordEntry *)
+		hash_search_with_hash_value(record->rhash, &k, k.hash,
+									HASH_FIND, &found);
+	/* Expired record is treated as missing */
+	if (!found || RecordExpired(item, GetCurrentTimestamp()))
+	{
+		free_record_tuple(record, tuple);
+		MemoryContextSwitchTo(oldcxt);
+		return false;
+	}
+
+	unindex_record(record, item);
+	/* Release old tuple unless it should be kept until savepoint releasing */
+	if (!save_record_change(variable, &k, item->tuple, item->expires))
+		free_record_tuple(record, item->tuple);
+	item->tuple = tuple;
+	/* Key value points into the tuple */
+	item->key.value = value;
+	index_record(record, item);
+
+	if (record->use_lru)
+	{
+		dlist_move_head(&record->list, &item->list_node);
+		evict_records(variable, record);
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+	return true;
+}
+
+bool
+delete_record(Variable *variable, Datum value, bool is_null)
+{
+	HashRecordKey k;
+	HashRecordEntry *item;
+	bool		found;
+	RecordVar  *record;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	/* Delete a record */
+	init_record_key(&k, record, value, is_null);
+
+	item = (HashRecordEntry *)
+		hash_search_with_hash_value(record->rhash, &k, k.hash,
+									HASH_REMOVE, &found);
+	if (!found)
+		return false;
+
+	/* Expired record is released, but it is treated as missing */
+	found = !RecordExpired(item, GetCurrentTimestamp());
+	forget_record(variable, record, item);
+
+	return found;
+}
+
+/*
+ * Bring back the records changed at the level of the state.
+ */
+void
+rollback_record_changes(VarState *state)
+{
+	RecordVar  *record = state->value.record;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *change,
+			   *item;
+	bool		found;
+
+	if (state->changes == NULL)
+		return;
+
+	/* It is cheaper to sort the records again if it is needed */
+	record->sorted_valid = false;
+
+	hash_seq_init(&rstat, state->changes);
+	while ((change = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		if (change->tuple)
+		{
+			/* The record was changed or deleted */
+			item = (HashRecordEntry *)
+				hash_search_with_hash_value(record->rhash, &change->key, change->key.hash,
+											HASH_ENTER, &found);
+			if (found)
+			{
+				unindex_record(record, item);
+				if (RecordInList(record, item))
+					dlist_delete(&item->list_node);
+				free_record_tuple(record, item->tuple);
+			}
+			item->key = change->key;
+			item->tuple = change->tuple;
+			item->expires = change->expires;
+			index_record(record, item);
+			if (RecordInList(record, item))
+				dlist_push_head(&record->list, &item->list_node);
+		}
+		else
+		{
+			/* The record was inserted */
+			item = (HashRecordEntry *)
+				hash_search_with_hash_value(record->rhash, &change->key, change->key.hash,
+											HASH_REMOVE, &found);
+			if (found)
+			{
+				record->nremoved++;
+				unindex_record(record, item);
+				if (RecordInList(record, item))
+					dlist_delete(&item->list_node);
+				free_record_tuple(record, item->tuple);
+			}
+			free_record_change(record, change);
+		}
+	}
+
+	hash_destroy(state->changes);
+	state->changes = NULL;
+}
+
+/*
+ * Pass the log of changes of the state to the previous state, which is going
+ * to be removed. Versions of the records saved by the previous state are
+ * older and win. If the previous state is the first state of the variable the
+ * log isn't needed anymore.
+ */
+void
+release_record_changes(VarState *state, VarState *prev, bool prev_is_first)
+{
+	RecordVar  *record = state->value.record;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *change,
+			   *item;
+	bool		found;
+
+	if (prev_is_first)
+	{
+		free_record_changes(state);
+		return;
+	}
+
+	if (state->changes == NULL)
+	{
+		state->changes = prev->changes;
+		prev->changes = NULL;
+		return;
+	}
+	else if (prev->changes == NULL)
+		return;
+
+	hash_seq_init(&rstat, state->changes);
+	while ((change = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		item = (HashRecordEntry *)
+			hash_search_with_hash_value(prev->changes, &change->key, change->key.hash,
+										HASH_ENTER, &found);
+		if (found)
+			free_record_change(record, change);
+		else
+		{
+			item->key = change->key;
+			item->tuple = change->tuple;
+			item->expires = change->expires;
+		}
+	}
+
+	hash_destroy(state->changes);
+	state->changes = prev->changes;
+	prev->changes = NULL;
+}
+
+/*
+ * Release the log of changes of the state.
+ */
+void
+free_record_changes(VarState *state)
+{
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *change;
+
+	if (state->changes == NULL)
+		return;
+
+	hash_seq_init(&rstat, state->changes);
+	while ((change = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		free_record_change(state->value.record, change);
+
+	hash_destroy(state->changes);
+	state->changes = NULL;
+}
+
+/*
+ * Move all tuples of the dense records storage into new blocks one after
+ * another and release old blocks.
+ */
+void
+compact_records(Variable *variable)
+{
+	RecordVar  *record;
+	RecordArena *oldarena;
+	ArenaBlock *block;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+
+	Assert(variable->typid == RECORDOID);
+
+	record = GetActualValue(variable).record;
+	oldarena = record->arena;
+	if (oldarena == NULL)
+		return;
+
+	/* Logs of changes refer to tuples too */
+	if (dlist_has_next(GetStateStorage(variable),
+					   &GetActualState(variable)->node))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("variable \"%s\" changed in current transaction can "
+						"not be compacted", GetName(variable))));
+
+	record->arena = MemoryContextAllocZero(record->hctx, sizeof(RecordArena));
+	/* Old tuples are released along with old blocks */
+	SubMemoryUsage(record->usage, record->data_size);
+	record->data_size = 0;
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		HeapTuple	tuple = alloc_record_tuple(record, item->tuple->t_len);
+
+		memcpy((char *) tuple->t_data, (char *) item->tuple->t_data,
+			   tuple->t_len);
+
+		/* Tuples bigger than chunks of blocks are released separately */
+		if (ArenaChunkSize(item->tuple->t_len) > ARENA_MAX_CHUNK)
+			pfree(item->tuple);
+
+		item->tuple = tuple;
+		/* Key value points into the tuple */
+		item->key.value = fastgetattr(tuple, 1, record->tupdesc,
+									  &item->key.is_null);
+	}
+
+	block = oldarena->blocks;
+	while (block != NULL)
+	{
+		ArenaBlock *next = block->next;
+
+		pfree(block);
+		block = next;
+	}
+	pfree(oldarena);
+}
+
+/*
+ * Number of records of the variable which are not expired at 'now'. Only
+ * records with expiration time have to be examined, they are all in the list
+ * of the records storage.
+ */
+static long
+count_live_records(RecordVar *record, TimestampTz now)
+{
+	long		nrecords;
+	dlist_iter	iter;
+
+	if (record->mapped)
+		return (long) record->mapped->header->nrecords;
+	if (record->rhash == NULL)
+		return 0;
+
+	nrecords = hash_get_num_entries(record->rhash);
+	dlist_foreach(iter, &record->list)
+	{
+		HashRecordEntry *item = dlist_container(HashRecordEntry, list_node,
+												iter.cur);
+
+		if (RecordExpired(item, now))
+			nrecords--;
+	}
+
+	return nrecords;
+}
+
+/*
+ * Number of records of the variable. Expired records are not counted.
+ */
+long
+count_records(RecordVar *record)
+{
+	return count_live_records(record, GetCurrentTimestamp());
+}
+
+/*
+ * Append the structure and the records of the variable to a dump made by
+ * pgv_dump(). Tuples are written as they are stored, expired records are
+ * skipped.
+ */
+void
+dump_records(RecordVar *record, StringInfo buf)
+{
+	TupleDesc	tupdesc = record->tupdesc;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	TimestampTz now;
+	int			i;
+
+	if (record->mapped)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("dumps of records mapped from a file are not supported")));
+
+	pq_sendint(buf, tupdesc->natts, 4);
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(tupdesc, i);
+
+		pq_sendstring(buf, NameStr(attr->attname));
+		pq_sendint(buf, attr->atttypid, 4);
+		pq_sendint(buf, attr->atttypmod, 4);
+		pq_sendint(buf, attr->attndims, 4);
+	}
+
+	now = GetCurrentTimestamp();
+	pq_sendint64(buf, count_live_records(record, now));
+
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		if (RecordExpired(item, now))
+			continue;
+		pq_sendint(buf, item->tuple->t_len, 4);
+		pq_sendbytes(buf, (char *) item->tuple->t_data, item->tuple->t_len);
+	}
+}
+
+/*
+ * Insert records from a dump made by dump_records() into the variable. The
+ * records hash of a new variable is presized to the number of records, and
+ * tuples are copied into the records storage directly.
+ */
+void
+restore_records(Variable *variable, StringInfo buf)
+{
+	RecordVar  *record;
+	TupleDesc	tupdesc;
+	int			natts;
+	int			i;
+	int64		nrecords;
+	MemoryContext oldcxt;
+
+	Assert(variable->typid == RECORDOID);
+
+	natts = pq_getmsgint(buf, 4);
+	if (natts < 1 || natts > MaxTupleAttributeNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid number of columns of variable \"%s\" in dump",
+						GetName(variable))));
+
+#if PG_VERSION_NUM >= 120000
+	tupdesc = CreateTemplateTupleDesc(natts);
+#else
+	tupdesc = CreateTemplateTupleDesc(natts, false);
+#endif
+	for (i = 0; i < natts; i++)
+	{
+		const char *attname = pq_getmsgstring(buf);
+		Oid			atttypid = pq_getmsgint(buf, 4);
+		int32		atttypmod = pq_getmsgint(buf, 4);
+		int			attndims = pq_getmsgint(buf, 4);
+
+		TupleDescInitEntry(tupdesc, (AttrNumber) (i + 1), attname,
+						   atttypid, atttypmod, attndims);
+	}
+	/* Stored records should have a registered type */
+	tupdesc = BlessTupleDesc(tupdesc);
+
+	nrecords = pq_getmsgint64(buf);
+
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	if (!record->tupdesc)
+		init_record(record, tupdesc, variable,
+					(long) Min(nrecords, PGV_RESTORE_MAX_PRESIZE));
+	else
+		check_attributes(variable, tupdesc);
 
-#include "pg_variables.h"
+	oldcxt = MemoryContextSwitchTo(record->hctx);
 
-/*
- * Hash function for records.
- *
- * We use the element type's default hash opclass, and the default collation
- * if the type is collation-sensitive.
- */
-static uint32
-record_hash(const void *key, Size keysize)
-{
-	HashRecordKey k = *((const HashRecordKey *) key);
-	Datum		h;
+	for (; nrecords > 0; nrecords--)
+	{
+		int			tuple_len = pq_getmsgint(buf, 4);
+		const char *data;
+		HeapTuple	tuple;
 
-	if (k.is_null)
-		return 0;
+		if (tuple_len < SizeofHeapTupleHeader)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid record of variable \"%s\" in dump",
+							GetName(variable))));
+		data = pq_getmsgbytes(buf, tuple_len);
+
+		tuple = alloc_record_tuple(record, tuple_len);
+		memcpy((char *) tuple->t_data, data, tuple_len);
+
+		if (HeapTupleHeaderGetNatts(tuple->t_data) != natts)
+		{
+			free_record_tuple(record, tuple);
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid record of variable \"%s\" in dump",
+							GetName(variable))));
+		}
+
+		/* Type of the record registered in this backend */
+		HeapTupleHeaderSetTypeId(tuple->t_data, tupdesc->tdtypeid);
+		HeapTupleHeaderSetTypMod(tuple->t_data, tupdesc->tdtypmod);
 
-	h = FunctionCall1Coll(k.hash_proc, DEFAULT_COLLATION_OID, k.value);
-	return DatumGetUInt32(h);
+		insert_record_internal(variable, record, tuple, 0);
+	}
+
+	MemoryContextSwitchTo(oldcxt);
 }
 
 /*
- * Matching function for records, to be used in hashtable lookups.
+ * Get the number of the column of records by its name.
  */
-static int
-record_match(const void *key1, const void *key2, Size keysize)
+static AttrNumber
+get_record_attnum(Variable *variable, RecordVar *record, const char *colname)
 {
-	HashRecordKey k1 = *((const HashRecordKey *) key1);
-	HashRecordKey k2 = *((const HashRecordKey *) key2);
-	Datum		c;
+	int			i;
 
-	if (k1.is_null)
+	for (i = 0; i < record->tupdesc->natts; i++)
 	{
-		if (k2.is_null)
-			return 0;			/* NULL "=" NULL */
-		else
-			return 1;			/* NULL ">" not-NULL */
+		Form_pg_attribute attr = GetTupleDescAttr(record->tupdesc, i);
+
+		if (!attr->attisdropped && namestrcmp(&attr->attname, colname) == 0)
+			return i + 1;
 	}
-	else if (k2.is_null)
-		return -1;				/* not-NULL "<" NULL */
 
-	c = FunctionCall2Coll(k1.cmp_proc, DEFAULT_COLLATION_OID,
-						  k1.value, k2.value);
-	return DatumGetInt32(c);
+	ereport(ERROR,
+			(errcode(ERRCODE_UNDEFINED_COLUMN),
+			 errmsg("column \"%s\" does not exist in variable \"%s\"",
+					colname, GetName(variable))));
+	return InvalidAttrNumber;	/* keep compiler quiet */
 }
 
+/*
+ * Create a hash index on a column of records other than the key. Entries of
+ * the index refer to entries of the records hash, so tuples aren't copied.
+ * Nothing is done if the index already exists.
+ */
 void
-init_record(RecordVar *record, TupleDesc tupdesc, Variable *variable)
+create_record_index(Variable *variable, const char *colname)
 {
+	RecordVar  *record;
+	AttrNumber	attnum;
+	RecordIndex *index;
 	HASHCTL		ctl;
 	char		hash_name[BUFSIZ];
-	MemoryContext oldcxt,
-				topctx;
-	TypeCacheEntry *typentry;
-	Oid			keyid;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	MemoryContext oldcxt;
 
 	Assert(variable->typid == RECORDOID);
 
-	sprintf(hash_name, "Records hash for variable \"%s\"", GetName(variable));
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
 
-	topctx = variable->is_transactional ?
-		variable->package->hctxTransact :
-		variable->package->hctxRegular;
+	attnum = get_record_attnum(variable, record, colname);
+	if (attnum == 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("column \"%s\" is the key of variable \"%s\"",
+						colname, GetName(variable))));
 
-#if PG_VERSION_NUM >= 110000
-	record->hctx = AllocSetContextCreateExtended(topctx,
-												 hash_name,
-												 ALLOCSET_DEFAULT_MINSIZE,
-												 ALLOCSET_DEFAULT_INITSIZE,
-												 ALLOCSET_DEFAULT_MAXSIZE);
-#else
-	record->hctx = AllocSetContextCreate(topctx,
-										 hash_name,
-										 ALLOCSET_DEFAULT_MINSIZE,
-										 ALLOCSET_DEFAULT_INITSIZE,
-										 ALLOCSET_DEFAULT_MAXSIZE);
-#endif
+	for (index = record->indexes; index != NULL; index = index->next)
+		if (index->attnum == attnum)
+			return;
 
 	oldcxt = MemoryContextSwitchTo(record->hctx);
-	record->tupdesc = CreateTupleDescCopyConstr(tupdesc);
 
-	/* Initialize hash table. */
+	index = (RecordIndex *) palloc0(sizeof(RecordIndex));
+	index->attnum = attnum;
+	init_key_type(&index->key_type,
+				  GetTupleDescAttr(record->tupdesc, attnum - 1)->atttypid);
+
+	snprintf(hash_name, BUFSIZ, "Index hash on column \"%s\" of variable \"%s\"",
+			 colname, GetName(variable));
+
 	ctl.keysize = sizeof(HashRecordKey);
-	ctl.entrysize = sizeof(HashRecordEntry);
+	ctl.entrysize = sizeof(RecordIndexEntry);
 	ctl.hcxt = record->hctx;
 	ctl.hash = record_hash;
 	ctl.match = record_match;
 
-	record->rhash = hash_create(hash_name, NUMVARIABLES, &ctl,
-								HASH_ELEM | HASH_CONTEXT |
-								HASH_FUNCTION | HASH_COMPARE);
-
-	/* Get hash and match functions for key type. */
-	keyid = GetTupleDescAttr(record->tupdesc, 0)->atttypid;
-	typentry = lookup_type_cache(keyid,
-								 TYPECACHE_HASH_PROC_FINFO |
-								 TYPECACHE_CMP_PROC_FINFO);
-
-	if (!OidIsValid(typentry->hash_proc_finfo.fn_oid))
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_FUNCTION),
-				 errmsg("could not identify a hash function for type %s",
-						format_type_be(keyid))));
+	index->hash = hash_create(hash_name,
+							  Max(hash_get_num_entries(record->rhash),
+								  NUMVARIABLES),
+							  &ctl,
+							  HASH_ELEM | HASH_CONTEXT |
+							  HASH_FUNCTION | HASH_COMPARE);
 
-	if (!OidIsValid(typentry->cmp_proc_finfo.fn_oid))
-		ereport(ERROR,
-				(errcode(ERRCODE_UNDEFINED_FUNCTION),
-				 errmsg("could not identify a matching function for type %s",
-						format_type_be(keyid))));
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+		add_index_item(record, index, item);
 
-	fmgr_info(typentry->hash_proc_finfo.fn_oid, &record->hash_proc);
-	fmgr_info(typentry->cmp_proc_finfo.fn_oid, &record->cmp_proc);
+	index->next = record->indexes;
+	record->indexes = index;
 
 	MemoryContextSwitchTo(oldcxt);
 }
 
 /*
- * New record structure should be the same as the first record.
+ * Find records with the value of the indexed column. Returns NULL if there
+ * are no such records.
  */
-void
-check_attributes(Variable *variable, TupleDesc tupdesc)
+RecordIndexEntry *
+search_record_index(Variable *variable, const char *colname, Oid typid,
+					Datum value, bool is_null)
 {
-	int			i;
 	RecordVar  *record;
+	AttrNumber	attnum;
+	RecordIndex *index;
+	HashRecordKey k;
+	RecordIndexEntry *entry;
+	bool		found;
 
 	Assert(variable->typid == RECORDOID);
 
-	record = &(GetActualValue(variable).record);
-	/* First, check columns count. */
-	if (record->tupdesc->natts != tupdesc->natts)
+	record = GetActualValue(variable).record;
+	attnum = get_record_attnum(variable, record, colname);
+
+	for (index = record->indexes; index != NULL; index = index->next)
+		if (index->attnum == attnum)
+			break;
+
+	if (index == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("there is no index on column \"%s\" of variable \"%s\"",
+						colname, GetName(variable))));
+
+	if (!is_null &&
+		GetTupleDescAttr(record->tupdesc, attnum - 1)->atttypid != typid)
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("new record structure differs from variable \"%s\" "
-						"structure", GetName(variable))));
+				 errmsg("requested value type differs from variable \"%s\" "
+						"column \"%s\" type", GetName(variable), colname)));
 
-	/* Second, check columns type. */
-	for (i = 0; i < tupdesc->natts; i++)
-	{
-		Form_pg_attribute attr1 = GetTupleDescAttr(record->tupdesc, i),
-					attr2 = GetTupleDescAttr(tupdesc, i);
+	init_hash_key(&k, &index->key_type, value, is_null);
 
-		if ((attr1->atttypid != attr2->atttypid)
-			|| (attr1->attndims != attr2->attndims)
-			|| (attr1->atttypmod != attr2->atttypmod))
-			ereport(ERROR,
-					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-					 errmsg("new record structure differs from variable \"%s\" "
-							"structure", GetName(variable))));
-	}
+	entry = (RecordIndexEntry *)
+		hash_search_with_hash_value(index->hash, &k, k.hash,
+									HASH_FIND, &found);
+
+	return found ? entry : NULL;
 }
 
 /*
- * Check record key type. If not same then throw a error.
+ * Write records of the variable into a file to be mapped by map_records().
+ * Records are written into a temporary file which then replaces the file, so
+ * backends which have the file mapped keep the old contents instead of
+ * getting SIGBUS on access to the truncated mapping.
  */
 void
-check_record_key(Variable *variable, Oid typid)
+save_records(Variable *variable, const char *filename)
 {
 	RecordVar  *record;
+	TupleDesc	tupdesc;
+	MappedHeader header;
+	MappedAttr *attrs;
+	MappedSlot *slots;
+	HashRecordEntry **items;
+	HASH_SEQ_STATUS rstat;
+	HashRecordEntry *item;
+	uint64		nrecords;
+	uint64		offset;
+	uint64		i;
+	TimestampTz now;
+	char	   *tmpname;
+	FILE	   *file;
+	static const char padding[MAXIMUM_ALIGNOF];
 
 	Assert(variable->typid == RECORDOID);
-	record = &(GetActualValue(variable).record);
 
-	if (GetTupleDescAttr(record->tupdesc, 0)->atttypid != typid)
+	record = GetActualValue(variable).record;
+	check_record_writable(variable, record);
+
+	tupdesc = record->tupdesc;
+	if (tupdesc == NULL)
 		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("requested value type differs from variable \"%s\" "
-						"key type", GetName(variable))));
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("variable \"%s\" has no records structure",
+						GetName(variable))));
+
+	memset(&header, 0, sizeof(header));
+	header.magic = MAPPED_MAGIC;
+	header.version = MAPPED_VERSION;
+	header.server_version = PG_VERSION_NUM / 100;
+	header.natts = tupdesc->natts;
+	now = GetCurrentTimestamp();
+	header.nrecords = nrecords = count_live_records(record, now);
+
+	/* Keep the index at most half full */
+	header.nslots = 16;
+	while (header.nslots < nrecords * 2)
+		header.nslots *= 2;
+
+	header.attrs_off = MAXALIGN(sizeof(MappedHeader));
+	header.slots_off = MAXALIGN(header.attrs_off +
+								header.natts * sizeof(MappedAttr));
+	offset = MAXALIGN(header.slots_off + header.nslots * sizeof(MappedSlot));
+
+	attrs = (MappedAttr *) palloc0(header.natts * sizeof(MappedAttr));
+	for (i = 0; i < header.natts; i++)
+	{
+		Form_pg_attribute attr = GetTupleDescAttr(tupdesc, i);
+
+		namestrcpy(&attrs[i].attname, NameStr(attr->attname));
+		attrs[i].atttypid = attr->atttypid;
+		attrs[i].atttypmod = attr->atttypmod;
+		attrs[i].attndims = attr->attndims;
+	}
+
+	/* Place tuples one after another and fill the index */
+	slots = (MappedSlot *) palloc_extended(header.nslots * sizeof(MappedSlot),
+										   MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+	items = (HashRecordEntry **)
+		palloc_extended(Max(nrecords, 1) * sizeof(HashRecordEntry *),
+						MCXT_ALLOC_HUGE);
+
+	i = 0;
+	hash_seq_init(&rstat, record->rhash);
+	while ((item = (HashRecordEntry *) hash_seq_search(&rstat)) != NULL)
+	{
+		uint64		slot = item->key.hash & (header.nslots - 1);
+
+		if (RecordExpired(item, now))
+			continue;
+		while (slots[slot].offset != 0)
+			slot = (slot + 1) & (header.nslots - 1);
+
+		slots[slot].hash = item->key.hash;
+		slots[slot].len = item->tuple->t_len;
+		slots[slot].offset = offset;
+
+		offset += MAXALIGN(item->tuple->t_len);
+		items[i++] = item;
+	}
+	header.size = offset;
+
+	tmpname = psprintf("%s.%d.tmp", filename, MyProcPid);
+	file = AllocateFile(tmpname, PG_BINARY_W);
+	if (file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for writing: %m",
+						tmpname)));
+
+#define WRITE_MAPPED(ptr, len) \
+	do { \
+		if ((len) > 0 && fwrite((ptr), 1, (len), file) != (len)) \
+			ereport(ERROR, \
+					(errcode_for_file_access(), \
+					 errmsg("could not write file \"%s\": %m", tmpname))); \
+	} while (0)
+
+	/* The temporary file is removed on errors */
+	PG_TRY();
+	{
+		WRITE_MAPPED(&header, sizeof(header));
+		WRITE_MAPPED(padding, header.attrs_off - sizeof(header));
+		WRITE_MAPPED(attrs, header.natts * sizeof(MappedAttr));
+		WRITE_MAPPED(padding, header.slots_off - header.attrs_off -
+					 header.natts * sizeof(MappedAttr));
+		WRITE_MAPPED(slots, header.nslots * sizeof(MappedSlot));
+		WRITE_MAPPED(padding, MAXALIGN(header.slots_off +
+									   header.nslots * sizeof(MappedSlot)) -
+					 (header.slots_off + header.nslots * sizeof(MappedSlot)));
+		for (i = 0; i < nrecords; i++)
+		{
+			HeapTuple	tuple = items[i]->tuple;
+
+			WRITE_MAPPED(tuple->t_data, tuple->t_len);
+			WRITE_MAPPED(padding, MAXALIGN(tuple->t_len) - tuple->t_len);
+		}
+
+		if (FreeFile(file))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not close file \"%s\": %m", tmpname)));
+
+		/* Replace the file, a mapped file must not be changed in place */
+		durable_rename(tmpname, filename, ERROR);
+	}
+	PG_CATCH();
+	{
+		unlink(tmpname);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+#undef WRITE_MAPPED
+
+	pfree(items);
+	pfree(slots);
+	pfree(attrs);
 }
 
+#ifndef WIN32
 /*
- * Insert a new record. New record key should be unique in the variable.
+ * Unmap the file when the memory context which owns the mapping is released.
  */
-void
-insert_record(Variable *variable, HeapTupleHeader tupleHeader)
+static void
+unmap_records(void *arg)
 {
-	TupleDesc	tupdesc;
-	HeapTuple	tuple;
-	int			tuple_len;
-	Datum		value;
-	bool		isnull;
-	RecordVar  *record;
-	HashRecordKey k;
-	HashRecordEntry *item;
-	bool		found;
-	MemoryContext oldcxt;
+	MappedRecords *mapped = (MappedRecords *) arg;
 
-	Assert(variable->typid == RECORDOID);
+	if (mapped->base != NULL)
+		munmap(mapped->base, mapped->size);
+}
+#endif
 
-	record = &(GetActualValue(variable).record);
+/*
+ * Map and validate a file written by save_records() and build the structure
+ * of its records. The mapping is owned by the current memory context until it
+ * is passed to a variable by map_records(), so it is released on errors.
+ */
+MappedRecords *
+open_mapped_records(const char *filename, TupleDesc *tupdesc)
+{
+#ifndef WIN32
+	MappedRecords *mapped;
+	MappedHeader *header;
+	MappedAttr *attrs;
+	struct stat st;
+	char	   *base;
+	int			fd;
+	uint64		i;
 
-	oldcxt = MemoryContextSwitchTo(record->hctx);
+#if PG_VERSION_NUM >= 110000
+	fd = OpenTransientFile(filename, O_RDONLY | PG_BINARY);
+#else
+	fd = OpenTransientFile((char *) filename, O_RDONLY | PG_BINARY, 0);
+#endif
+	if (fd < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", filename)));
 
-	tupdesc = record->tupdesc;
+	if (fstat(fd, &st) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not stat file \"%s\": %m", filename)));
 
-	/* Build a HeapTuple control structure */
-	tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+	if ((Size) st.st_size < sizeof(MappedHeader))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("file \"%s\" is not a file of records", filename)));
 
-	tuple = (HeapTuple) palloc(HEAPTUPLESIZE + tuple_len);
-	tuple->t_len = tuple_len;
-	ItemPointerSetInvalid(&(tuple->t_self));
-	tuple->t_tableOid = InvalidOid;
-	tuple->t_data = (HeapTupleHeader) ((char *) tuple + HEAPTUPLESIZE);
-	memcpy((char *) tuple->t_data, (char *) tupleHeader, tuple_len);
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not map file \"%s\": %m", filename)));
 
-	/* Inserting a new record */
-	value = fastgetattr(tuple, 1, tupdesc, &isnull);
-	/* First, check if there is a record with same key */
-	k.value = value;
-	k.is_null = isnull;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+	CloseTransientFile(fd);
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_ENTER, &found);
-	if (found)
-	{
-		heap_freetuple(tuple);
-		MemoryContextSwitchTo(oldcxt);
+	mapped = palloc0(sizeof(MappedRecords));
+	mapped->base = base;
+	mapped->size = st.st_size;
+	mapped->callback.func = unmap_records;
+	mapped->callback.arg = mapped;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext,
+									   &mapped->callback);
+
+	header = (MappedHeader *) base;
+	if (header->magic != MAPPED_MAGIC ||
+		header->version != MAPPED_VERSION ||
+		header->server_version != PG_VERSION_NUM / 100 ||
+		header->size != (uint64) st.st_size ||
+		header->natts < 1 || header->natts > MaxTupleAttributeNumber ||
+		header->nslots == 0 ||
+		(header->nslots & (header->nslots - 1)) != 0 ||
+		header->nrecords >= header->nslots ||
+		header->attrs_off + header->natts * sizeof(MappedAttr) > header->size ||
+		header->slots_off + header->nslots * sizeof(MappedSlot) > header->size)
 		ereport(ERROR,
-				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				 errmsg("there is a record in the variable \"%s\" with same "
-						"key", GetName(variable))));
-	}
-	/* Second, insert a new record */
-	item->tuple = tuple;
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("file \"%s\" is not a file of records or was written "
+						"by another server version", filename)));
 
-	MemoryContextSwitchTo(oldcxt);
+	mapped->header = header;
+	mapped->slots = (MappedSlot *) (base + header->slots_off);
+
+#if PG_VERSION_NUM >= 120000
+	*tupdesc = CreateTemplateTupleDesc(header->natts);
+#else
+	*tupdesc = CreateTemplateTupleDesc(header->natts, false);
+#endif
+	attrs = (MappedAttr *) (base + header->attrs_off);
+	for (i = 0; i < header->natts; i++)
+		TupleDescInitEntry(*tupdesc, (AttrNumber) (i + 1),
+						   NameStr(attrs[i].attname), attrs[i].atttypid,
+						   attrs[i].atttypmod, attrs[i].attndims);
+	*tupdesc = BlessTupleDesc(*tupdesc);
+
+	return mapped;
+#else
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("mapping of records is not supported on this platform")));
+	return NULL;				/* keep compiler quiet */
+#endif
 }
 
 /*
- * Insert a record. New record key should be unique in the variable.
+ * Make the records opened by open_mapped_records() records of the new
+ * variable. The mapping is released with the records memory context.
  */
-bool
-update_record(Variable *variable, HeapTupleHeader tupleHeader)
+void
+map_records(Variable *variable, MappedRecords *opened, TupleDesc tupdesc)
 {
-	TupleDesc	tupdesc;
-	HeapTuple	tuple;
-	int			tuple_len;
-	Datum		value;
-	bool		isnull;
+#ifndef WIN32
 	RecordVar  *record;
-	HashRecordKey k;
-	HashRecordEntry *item;
-	bool		found;
-	MemoryContext oldcxt;
+	MappedRecords *mapped;
 
 	Assert(variable->typid == RECORDOID);
 
-	record = &(GetActualValue(variable).record);
+	record = GetActualValue(variable).record;
+	if (record->tupdesc)
+		ereport(ERROR,
+				(errcode(ERRCODE_DUPLICATE_OBJECT),
+				 errmsg("variable \"%s\" already has records",
+						GetName(variable))));
 
-	oldcxt = MemoryContextSwitchTo(record->hctx);
+	/* The records hash stays empty */
+	init_record(record, tupdesc, variable, 0);
 
-	tupdesc = record->tupdesc;
+	mapped = MemoryContextAllocZero(record->hctx, sizeof(MappedRecords));
+	mapped->base = opened->base;
+	mapped->size = opened->size;
+	mapped->header = opened->header;
+	mapped->slots = opened->slots;
+	mapped->callback.func = unmap_records;
+	mapped->callback.arg = mapped;
+	MemoryContextRegisterResetCallback(record->hctx, &mapped->callback);
 
-	/* Build a HeapTuple control structure */
-	tuple_len = HeapTupleHeaderGetDatumLength(tupleHeader);
+	/* The previous owner must not unmap the file anymore */
+	opened->base = NULL;
 
-	tuple = (HeapTuple) palloc(HEAPTUPLESIZE + tuple_len);
-	tuple->t_len = tuple_len;
+	record->mapped = mapped;
+#endif
+}
+
+/*
+ * Point 'tuple' to the mapped tuple of the slot. Returns false if the slot is
+ * empty.
+ */
+static bool
+get_mapped_slot_tuple(MappedRecords *mapped, MappedSlot *slot,
+					  HeapTuple tuple)
+{
+	if (slot->offset == 0)
+		return false;
+
+	if (slot->offset + slot->len > mapped->size ||
+		slot->len < SizeofHeapTupleHeader)
+		ereport(ERROR,
+				(errcode(ERRCODE_DATA_CORRUPTED),
+				 errmsg("invalid slot of mapped records")));
+
+	tuple->t_len = slot->len;
 	ItemPointerSetInvalid(&(tuple->t_self));
 	tuple->t_tableOid = InvalidOid;
-	tuple->t_data = (HeapTupleHeader) ((char *) tuple + HEAPTUPLESIZE);
-	memcpy((char *) tuple->t_data, (char *) tupleHeader, tuple_len);
+	tuple->t_data = (HeapTupleHeader) (mapped->base + slot->offset);
 
-	/* Update a record */
-	value = fastgetattr(tuple, 1, tupdesc, &isnull);
-	k.value = value;
-	k.is_null = isnull;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+	return true;
+}
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_FIND, &found);
-	if (!found)
+/*
+ * Get the next mapped record for a full scan starting from zero '*pos'. The
+ * tuple points into the read-only mapping, so its type is not valid in this
+ * backend. Returns false when there are no more records.
+ */
+bool
+get_mapped_record(RecordVar *record, uint64 *pos, HeapTuple tuple)
+{
+	MappedRecords *mapped = record->mapped;
+
+	while (*pos < mapped->header->nslots)
 	{
-		heap_freetuple(tuple);
-		MemoryContextSwitchTo(oldcxt);
-		return false;
+		if (get_mapped_slot_tuple(mapped, &mapped->slots[(*pos)++], tuple))
+			return true;
 	}
 
-	/* Release old tuple */
-	heap_freetuple(item->tuple);
-	item->tuple = tuple;
-
-	MemoryContextSwitchTo(oldcxt);
-	return true;
+	return false;
 }
 
-bool
-delete_record(Variable *variable, Datum value, bool is_null)
+/*
+ * Find the record by its key. For mapped records returns a copy of the tuple
+ * allocated in the current memory context. Returns NULL if there is no such
+ * record or the record is expired. The found record of a cache package
+ * becomes the most recently used.
+ */
+HeapTuple
+search_record(RecordVar *record, Datum value, bool is_null)
 {
+	MappedRecords *mapped = record->mapped;
 	HashRecordKey k;
-	HashRecordEntry *item;
-	bool		found;
-	RecordVar  *record;
+	uint64		mask;
+	uint64		slot;
+	uint64		n;
 
-	Assert(variable->typid == RECORDOID);
+	init_record_key(&k, record, value, is_null);
 
-	record = &(GetActualValue(variable).record);
+	if (mapped == NULL)
+	{
+		HashRecordEntry *item;
+		bool		found;
 
-	/* Delete a record */
-	k.value = value;
-	k.is_null = is_null;
-	k.hash_proc = &record->hash_proc;
-	k.cmp_proc = &record->cmp_proc;
+		item = (HashRecordEntry *)
+			hash_search_with_hash_value(record->rhash, &k, k.hash,
+										HASH_FIND, &found);
+		if (!found || RecordExpired(item, GetCurrentTimestamp()))
+			return NULL;
+		if (record->use_lru)
+			dlist_move_head(&record->list, &item->list_node);
+		return item->tuple;
+	}
 
-	item = (HashRecordEntry *) hash_search(record->rhash, &k,
-										   HASH_REMOVE, &found);
-	if (found)
-		heap_freetuple(item->tuple);
+	mask = mapped->header->nslots - 1;
+	for (slot = k.hash & mask, n = 0; n <= mask; slot = (slot + 1) & mask, n++)
+	{
+		HeapTupleData tuple;
+		HashRecordKey k2;
+		HeapTuple	result;
 
-	return found;
+		if (!get_mapped_slot_tuple(mapped, &mapped->slots[slot], &tuple))
+			break;
+		if (mapped->slots[slot].hash != k.hash)
+			continue;
+
+		k2.value = fastgetattr(&tuple, 1, record->tupdesc, &k2.is_null);
+		k2.hash = k.hash;
+		k2.type = &record->key_type;
+		if (record_match(&k, &k2, sizeof(HashRecordKey)) != 0)
+			continue;
+
+		result = heap_copytuple(&tuple);
+		HeapTupleHeaderSetTypeId(result->t_data, record->tupdesc->tdtypeid);
+		HeapTupleHeaderSetTypMod(result->t_data, record->tupdesc->tdtypmod);
+		return result;
+	}
+
+	return NULL;
 }
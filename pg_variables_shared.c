@@ -0,0 +1,554 @@
+/*-------------------------------------------------------------------------
+ *
+ * pg_variables_shared.c
+ *	  Scalar variables shared by all backends
+ *
+ * Shared variables are kept in a DSA area in a dshash table, so there is a
+ * single copy of a value for all backends of a database. They are not
+ * transactional.
+ *
+ * Copyright (c) 2015-2016, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+
+#include "catalog/pg_type.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#if PG_VERSION_NUM >= 110000
+#include "lib/dshash.h"
+#include "utils/dsa.h"
+#endif
+
+#include "pg_variables.h"
+
+PG_FUNCTION_INFO_V1(variable_set_shared);
+PG_FUNCTION_INFO_V1(variable_get_shared);
+PG_FUNCTION_INFO_V1(remove_shared_variable);
+
+#define PGV_SHMEM_NAME		"pg_variables: shared variables"
+#define PGV_TRANCHE_NAME	"pg_variables"
+
+#if PG_VERSION_NUM >= 110000
+
+/*
+ * Key of the shared variables hash. Variables are separate for each database,
+ * so type OIDs of values are compared only within the database.
+ */
+typedef struct SharedVarKey
+{
+	Oid			dbid;
+	char		package[NAMEDATALEN];
+	char		name[NAMEDATALEN];
+}			SharedVarKey;
+
+typedef struct SharedVarEntry
+{
+	SharedVarKey key;
+	/* Role which created the variable, only it can change or remove it */
+	Oid			owner;
+	Oid			typid;
+	bool		is_null;
+	bool		typbyval;
+	int16		typlen;
+	/* Value of a by-value type */
+	Datum		value;
+	/* Copy of a value of a by-reference type in the DSA area */
+	dsa_pointer data;
+}			SharedVarEntry;
+
+/* State of shared variables in the main shared memory segment */
+typedef struct SharedVarsState
+{
+	/* Protects creation of the DSA area and of the hash */
+	LWLock	   *lock;
+	int			tranche_id;
+	bool		initialized;
+	dsa_handle	area;
+	dshash_table_handle hash;
+}			SharedVarsState;
+
+static SharedVarsState *sharedState = NULL;
+static dsa_area *sharedArea = NULL;
+static dshash_table *sharedHash = NULL;
+
+/* Limit of the size of the DSA area in kilobytes, zero disables the limit */
+static int	maxSharedMemory = 0;
+/* Limit last applied to the area by the backend, -1 if not applied yet */
+static int	appliedSharedMemory = -1;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void
+sharedVarsShmemRequest(void)
+{
+#if PG_VERSION_NUM >= 150000
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(SharedVarsState)));
+	RequestNamedLWLockTranche(PGV_TRANCHE_NAME, 1);
+}
+
+static void
+sharedVarsShmemStartup(void)
+{
+	bool		found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	sharedState = ShmemInitStruct(PGV_SHMEM_NAME, sizeof(SharedVarsState),
+								  &found);
+	if (!found)
+	{
+		sharedState->lock = &(GetNamedLWLockTranche(PGV_TRANCHE_NAME))->lock;
+		sharedState->tranche_id = LWLockNewTrancheId();
+		sharedState->initialized = false;
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Install hooks to allocate the shared state. Shared variables are available
+ * only if the library is loaded via shared_preload_libraries.
+ */
+void
+init_shared_variables(void)
+{
+	DefineCustomIntVariable("pg_variables.max_shared_memory",
+							"Maximum memory used by shared variables of all backends.",
+							"Zero disables the limit.",
+							&maxSharedMemory,
+							65536, 0, INT_MAX,
+							PGC_SIGHUP,
+							GUC_UNIT_KB,
+							NULL, NULL, NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = sharedVarsShmemRequest;
+#else
+	sharedVarsShmemRequest();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = sharedVarsShmemStartup;
+}
+
+/*
+ * Attach to the DSA area and to the hash of shared variables, create them if
+ * this is the first use of shared variables since the server start.
+ */
+static void
+attachSharedVars(void)
+{
+	dshash_parameters params;
+	MemoryContext oldcxt;
+
+	if (sharedHash != NULL)
+		return;
+
+	if (sharedState == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("shared variables require pg_variables to be loaded via shared_preload_libraries")));
+
+	memset(&params, 0, sizeof(params));
+	params.key_size = sizeof(SharedVarKey);
+	params.entry_size = sizeof(SharedVarEntry);
+	params.compare_function = dshash_memcmp;
+	params.hash_function = dshash_memhash;
+#if PG_VERSION_NUM >= 170000
+	params.copy_function = dshash_memcpy;
+#endif
+	params.tranche_id = sharedState->tranche_id;
+
+	LWLockRegisterTranche(sharedState->tranche_id, PGV_TRANCHE_NAME);
+
+	/* The area and the hash are used until the backend exits */
+	oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+	LWLockAcquire(sharedState->lock, LW_EXCLUSIVE);
+
+	if (!sharedState->initialized)
+	{
+		sharedArea = dsa_create(sharedState->tranche_id);
+		dsa_pin(sharedArea);
+		sharedHash = dshash_create(sharedArea, &params, NULL);
+
+		sharedState->area = dsa_get_handle(sharedArea);
+		sharedState->hash = dshash_get_hash_table_handle(sharedHash);
+		sharedState->initialized = true;
+	}
+	else
+	{
+		sharedArea = dsa_attach(sharedState->area);
+		sharedHash = dshash_attach(sharedArea, &params, sharedState->hash,
+								   NULL);
+	}
+	dsa_pin_mapping(sharedArea);
+
+	LWLockRelease(sharedState->lock);
+	MemoryContextSwitchTo(oldcxt);
+}
+
+static void
+copyName(text *name, char *key)
+{
+	int			key_len = VARSIZE_ANY_EXHDR(name);
+
+	if (key_len >= NAMEDATALEN - 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("name \"%.*s\" is too long",
+						key_len, VARDATA_ANY(name))));
+
+	memcpy(key, VARDATA_ANY(name), key_len);
+	key[key_len] = '\0';
+}
+
+static void
+makeSharedKey(SharedVarKey *key, text *package_name, text *var_name)
+{
+	/* Padding bytes take part in hashing and comparison of keys */
+	memset(key, 0, sizeof(SharedVarKey));
+	key->dbid = MyDatabaseId;
+	copyName(package_name, key->package);
+	copyName(var_name, key->name);
+}
+
+/*
+ * Apply pg_variables.max_shared_memory to the area. The limit is kept in the
+ * area, so it is set again only when the parameter is changed.
+ */
+static void
+applySharedMemoryLimit(void)
+{
+	if (appliedSharedMemory == maxSharedMemory)
+		return;
+
+	dsa_set_size_limit(sharedArea, maxSharedMemory > 0 ?
+					   (size_t) maxSharedMemory * 1024 : SIZE_MAX);
+	appliedSharedMemory = maxSharedMemory;
+}
+
+static void
+reportSharedMemoryLimit(void)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+			 errmsg("shared variables use more memory than allowed by pg_variables.max_shared_memory")));
+}
+
+static void
+reportNotOwner(SharedVarKey *key)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+			 errmsg("must be owner of shared variable \"%s\"", key->name)));
+}
+
+static void
+reportWrongType(SharedVarKey *key, Oid typid)
+{
+	char	   *var_type = DatumGetCString(DirectFunctionCall1(regtypeout,
+															   ObjectIdGetDatum(typid)));
+
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("variable \"%s\" requires \"%s\" value",
+					key->name, var_type)));
+}
+
+/*
+ * Set value of a shared variable. The new value is copied into the DSA area
+ * before the entry is locked, so the entry lock is held only to swap values.
+ * Readers see either the old or the new value. An existing variable can be
+ * changed only by its owner or by a superuser.
+ */
+static void
+sharedVariableSet(text *package_name, text *var_name, Oid typid,
+				  Datum value, bool is_null)
+{
+	SharedVarKey key;
+	SharedVarEntry *entry;
+	bool		found;
+	bool		typbyval;
+	int16		typlen;
+	dsa_pointer newdata = InvalidDsaPointer;
+	dsa_pointer olddata = InvalidDsaPointer;
+	Oid			userid = GetUserId();
+	bool		is_superuser = superuser();
+
+	attachSharedVars();
+	applySharedMemoryLimit();
+	makeSharedKey(&key, package_name, var_name);
+	get_typlenbyval(typid, &typlen, &typbyval);
+
+	if (!is_null && !typbyval)
+	{
+		Size		size;
+
+		/* Store a plain value, not a toast pointer or an expanded object */
+		if (typlen == -1)
+			value = PointerGetDatum(PG_DETOAST_DATUM(value));
+
+		size = datumGetSize(value, typbyval, typlen);
+		newdata = dsa_allocate_extended(sharedArea, size, DSA_ALLOC_NO_OOM);
+		if (!DsaPointerIsValid(newdata))
+			reportSharedMemoryLimit();
+		memcpy(dsa_get_address(sharedArea, newdata), DatumGetPointer(value),
+			   size);
+	}
+
+	/* Growth of the hash fails with an error too if the area is full */
+	PG_TRY();
+	{
+		entry = dshash_find_or_insert(sharedHash, &key, &found);
+	}
+	PG_CATCH();
+	{
+		if (DsaPointerIsValid(newdata))
+			dsa_free(sharedArea, newdata);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (found && entry->owner != userid && !is_superuser)
+	{
+		dshash_release_lock(sharedHash, entry);
+		if (DsaPointerIsValid(newdata))
+			dsa_free(sharedArea, newdata);
+		reportNotOwner(&key);
+	}
+	if (found && entry->typid != typid)
+	{
+		Oid			var_typid = entry->typid;
+
+		dshash_release_lock(sharedHash, entry);
+		if (DsaPointerIsValid(newdata))
+			dsa_free(sharedArea, newdata);
+		reportWrongType(&key, var_typid);
+	}
+
+	if (found)
+		olddata = entry->data;
+	else
+		entry->owner = userid;
+
+	entry->typid = typid;
+	entry->is_null = is_null;
+	entry->typbyval = typbyval;
+	entry->typlen = typlen;
+	entry->value = (!is_null && typbyval) ? value : (Datum) 0;
+	entry->data = newdata;
+
+	dshash_release_lock(sharedHash, entry);
+
+	/* Nobody can read the old value after the entry lock is released */
+	if (DsaPointerIsValid(olddata))
+		dsa_free(sharedArea, olddata);
+}
+
+/*
+ * Get a copy of value of a shared variable. The entry is locked in shared
+ * mode only while the value is copied.
+ */
+static Datum
+sharedVariableGet(text *package_name, text *var_name, Oid typid,
+				  bool *is_null, bool strict)
+{
+	SharedVarKey key;
+	SharedVarEntry *entry;
+	Datum		value = (Datum) 0;
+
+	attachSharedVars();
+	makeSharedKey(&key, package_name, var_name);
+
+	entry = dshash_find(sharedHash, &key, false);
+	if (entry == NULL)
+	{
+		if (strict)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("unrecognized variable \"%s\"", key.name)));
+
+		*is_null = true;
+		return (Datum) 0;
+	}
+
+	if (entry->typid != typid)
+	{
+		Oid			var_typid = entry->typid;
+
+		dshash_release_lock(sharedHash, entry);
+		reportWrongType(&key, var_typid);
+	}
+
+	*is_null = entry->is_null;
+	if (!entry->is_null)
+	{
+		if (entry->typbyval)
+			value = entry->value;
+		else
+			value = datumCopy(PointerGetDatum(dsa_get_address(sharedArea,
+															  entry->data)),
+							  false, entry->typlen);
+	}
+
+	dshash_release_lock(sharedHash, entry);
+
+	return value;
+}
+
+static void
+sharedVariableRemove(text *package_name, text *var_name)
+{
+	SharedVarKey key;
+	SharedVarEntry *entry;
+	dsa_pointer data;
+	bool		is_superuser = superuser();
+
+	attachSharedVars();
+	makeSharedKey(&key, package_name, var_name);
+
+	entry = dshash_find(sharedHash, &key, true);
+	if (entry == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("unrecognized variable \"%s\"", key.name)));
+	if (entry->owner != GetUserId() && !is_superuser)
+	{
+		dshash_release_lock(sharedHash, entry);
+		reportNotOwner(&key);
+	}
+
+	data = entry->data;
+	dshash_delete_entry(sharedHash, entry);
+
+	if (DsaPointerIsValid(data))
+		dsa_free(sharedArea, data);
+}
+
+#else							/* PG_VERSION_NUM < 110000 */
+
+void
+init_shared_variables(void)
+{
+}
+
+static void
+sharedVarsNotSupported(void)
+{
+	ereport(ERROR,
+			(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+			 errmsg("shared variables require PostgreSQL 11 or newer")));
+}
+
+static void
+sharedVariableSet(text *package_name, text *var_name, Oid typid,
+				  Datum value, bool is_null)
+{
+	sharedVarsNotSupported();
+}
+
+static Datum
+sharedVariableGet(text *package_name, text *var_name, Oid typid,
+				  bool *is_null, bool strict)
+{
+	sharedVarsNotSupported();
+	return (Datum) 0;
+}
+
+static void
+sharedVariableRemove(text *package_name, text *var_name)
+{
+	sharedVarsNotSupported();
+}
+
+#endif							/* PG_VERSION_NUM >= 110000 */
+
+Datum
+variable_set_shared(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	sharedVariableSet(package_name, var_name,
+					  get_fn_expr_argtype(fcinfo->flinfo, 2),
+					  PG_ARGISNULL(2) ? 0 : PG_GETARG_DATUM(2),
+					  PG_ARGISNULL(2));
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+	PG_RETURN_VOID();
+}
+
+Datum
+variable_get_shared(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+	bool		strict;
+	bool		isnull;
+	Datum		value;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+	strict = PG_GETARG_BOOL(3);
+
+	value = sharedVariableGet(package_name, var_name,
+							  get_fn_expr_argtype(fcinfo->flinfo, 2),
+							  &isnull, strict);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+
+	if (!isnull)
+		PG_RETURN_DATUM(value);
+	else
+		PG_RETURN_NULL();
+}
+
+Datum
+remove_shared_variable(PG_FUNCTION_ARGS)
+{
+	text	   *package_name;
+	text	   *var_name;
+
+	CHECK_ARGS_FOR_NULL();
+
+	package_name = PG_GETARG_TEXT_PP(0);
+	var_name = PG_GETARG_TEXT_PP(1);
+
+	sharedVariableRemove(package_name, var_name);
+
+	PG_FREE_IF_COPY(package_name, 0);
+	PG_FREE_IF_COPY(var_name, 1);
+	PG_RETURN_VOID();
+}
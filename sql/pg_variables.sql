@@ -191,3 +191,315 @@ SELECT pgv_free();
 SELECT pgv_exists('vars');
 
 SELECT * FROM pgv_list() order by package, name;
+
+-- Load records from a query
+SELECT pgv_load('vars4', 'r1', 'SELECT i, ''str'' || i FROM generate_series(1, 5) i');
+SELECT * FROM pgv_select('vars4', 'r1') AS (id int, t text) ORDER BY id;
+SELECT pgv_load('vars4', 'r1', 'SELECT i, ''str'' || i FROM generate_series(6, 7) i');
+SELECT pgv_select('vars4', 'r1', 7);
+SELECT pgv_load('vars4', 'r1', 'SELECT 1::bigint');
+SELECT pgv_load('vars4', 'r1', 'SELECT i, ''dup'' FROM generate_series(1, 2) i');
+SELECT pgv_load('vars4', 'r1', 'SELECT i, ''str'' || i FROM generate_series(1, 0) i');
+SELECT pgv_remove('vars4');
+
+-- Dense records storage
+SET pg_variables.dense_records = on;
+SELECT pgv_load('vars4', 'r2', 'SELECT i, ''str'' || i FROM generate_series(1, 5) i');
+SELECT pgv_delete('vars4', 'r2', 2);
+SELECT pgv_update('vars4', 'r2', row(3, 'str33'::text));
+SELECT pgv_insert('vars4', 'r2', row(6, 'str6'::text));
+SELECT pgv_compact('vars4', 'r2');
+SELECT * FROM pgv_select('vars4', 'r2') AS (id int, t text) ORDER BY id;
+SELECT pgv_select('vars4', 'r2', 3);
+RESET pg_variables.dense_records;
+SELECT pgv_remove('vars4');
+
+-- Ordered scans of records
+SELECT pgv_load('vars4', 'r1', 'SELECT i * 10 AS id, ''str'' || i AS t FROM generate_series(5, 1, -1) i');
+SELECT * FROM pgv_select_ordered('vars4', 'r1') AS (id int, t text);
+SELECT pgv_insert('vars4', 'r1', row(25, 'str25'::text));
+SELECT pgv_delete('vars4', 'r1', 40);
+SELECT * FROM pgv_select_range('vars4', 'r1', 15, 45) AS (id int, t text);
+SELECT * FROM pgv_select_range('vars4', 'r1', 25, NULL) AS (id int, t text);
+SELECT * FROM pgv_select_range('vars4', 'r1', 45, 15) AS (id int, t text);
+SELECT * FROM pgv_select_le('vars4', 'r1', 29) AS (id int, t text);
+SELECT * FROM pgv_select_le('vars4', 'r1', 5) AS (id int, t text);
+SELECT * FROM pgv_select_range('vars4', 'r1', 'str1', 'str2') AS (id int, t text);
+
+SELECT pgv_insert('vars4', 'r2', row('b'::text, 1), true);
+SELECT * FROM pgv_select_ordered('vars4', 'r2') AS (t text, id int);
+BEGIN;
+SELECT pgv_insert('vars4', 'r2', row('a'::text, 0), true);
+SELECT pgv_insert('vars4', 'r2', row('c'::text, 2), true);
+SELECT * FROM pgv_select_ordered('vars4', 'r2') AS (t text, id int);
+ROLLBACK;
+SELECT * FROM pgv_select_ordered('vars4', 'r2') AS (t text, id int);
+SELECT pgv_remove('vars4');
+
+-- Indexes on other columns of records
+SELECT pgv_load('vars4', 'r1', 'SELECT i AS id, ''code'' || (i % 3) AS code, i * 10 AS val FROM generate_series(1, 6) i');
+SELECT pgv_create_index('vars4', 'r1', 'code');
+SELECT * FROM pgv_select_by('vars4', 'r1', 'code', 'code1'::text) AS (id int, code text, val int) ORDER BY id;
+SELECT pgv_update('vars4', 'r1', row(4, 'code2'::text, 40));
+SELECT pgv_delete('vars4', 'r1', 1);
+SELECT * FROM pgv_select_by('vars4', 'r1', 'code', 'code1'::text) AS (id int, code text, val int) ORDER BY id;
+SELECT * FROM pgv_select_by('vars4', 'r1', 'code', 'code2'::text) AS (id int, code text, val int) ORDER BY id;
+SELECT pgv_create_index('vars4', 'r1', 'val');
+SELECT * FROM pgv_select_by('vars4', 'r1', 'val', 30) AS (id int, code text, val int);
+SELECT * FROM pgv_select_by('vars4', 'r1', 'code', 1) AS (id int, code text, val int);
+SELECT * FROM pgv_select_by('vars4', 'r1', 'id', 1) AS (id int, code text, val int);
+SELECT pgv_create_index('vars4', 'r1', 'id');
+SELECT pgv_create_index('vars4', 'r1', 'nope');
+
+SELECT pgv_load('vars4', 'r2', 'SELECT i AS id, ''c'' || (i % 2) AS code FROM generate_series(1, 4) i', true);
+SELECT pgv_create_index('vars4', 'r2', 'code');
+BEGIN;
+SELECT pgv_delete('vars4', 'r2', 1);
+SAVEPOINT sp1;
+SELECT pgv_update('vars4', 'r2', row(2, 'c1'::text));
+SELECT pgv_insert('vars4', 'r2', row(5, 'c1'::text), true);
+SELECT * FROM pgv_select_by('vars4', 'r2', 'code', 'c1'::text) AS (id int, code text) ORDER BY id;
+ROLLBACK TO sp1;
+SELECT * FROM pgv_select_by('vars4', 'r2', 'code', 'c1'::text) AS (id int, code text) ORDER BY id;
+ROLLBACK;
+SELECT * FROM pgv_select_by('vars4', 'r2', 'code', 'c1'::text) AS (id int, code text) ORDER BY id;
+SELECT pgv_remove('vars4');
+
+-- Lookups of many keys
+SELECT pgv_load('vars4', 'r1', 'SELECT i AS id, ''str'' || i AS t FROM generate_series(1, 5) i');
+SELECT * FROM pgv_select('vars4', 'r1', ARRAY[4, 0, 2, NULL, 4]) AS (id int, t text);
+SELECT * FROM pgv_select_ordinality('vars4', 'r1', ARRAY[4, 0, 2, NULL, 4]) AS (n bigint, id int, t text);
+SELECT pgv_select_ordinality('vars4', 'r1', ARRAY[3]);
+SELECT pgv_remove('vars4');
+
+-- Changes of records while they are read
+SELECT pgv_load('vars4', 'r1', 'SELECT i, ''str'' || i FROM generate_series(1, 3) i');
+SELECT pgv_insert('vars4', 'r1', row(s.i + 10, s.t)) FROM pgv_select('vars4', 'r1') AS s(i int, t text);
+SELECT * FROM pgv_select('vars4', 'r1') AS (i int, t text) ORDER BY i;
+SELECT pgv_remove('vars4');
+
+-- Shared variables require the module in shared_preload_libraries
+SELECT pgv_set_shared('vars', 'int1', 101);
+SELECT pgv_get_shared('vars', 'int1', NULL::int);
+
+-- Parallel safety of functions which read variables
+SELECT DISTINCT proname, proparallel FROM pg_proc
+	WHERE proname IN ('pgv_get', 'pgv_select', 'pgv_get_shared') ORDER BY proname;
+
+-- Dumps of packages
+SELECT pgv_set('vars5', 'int1', 101);
+SELECT pgv_set('vars5', 'str1', 'dump'::text, true);
+SELECT pgv_insert('vars5', 'r1', row(1, 'str1'::text));
+SELECT pgv_insert('vars5', 'r1', row(2, NULL::text));
+CREATE TEMP TABLE dumps AS SELECT pgv_dump('vars5') AS d;
+SELECT pgv_remove('vars5');
+SELECT pgv_restore(d) FROM dumps;
+SELECT pgv_get('vars5', 'int1', NULL::int);
+SELECT pgv_get('vars5', 'str1', NULL::text);
+SELECT * FROM pgv_select('vars5', 'r1') AS (id int, t text) ORDER BY id;
+SELECT pgv_restore('\x00'::bytea);
+SELECT pgv_remove('vars5');
+
+-- Records mapped from a file
+SELECT pgv_insert('vars5', 'r1', row(1, 'str1'::text));
+SELECT pgv_insert('vars5', 'r1', row(2, 'str2'::text));
+SELECT pgv_insert('vars5', 'r1', row(3, NULL::text));
+SELECT pgv_save('vars5', 'r1', 'pgv_records.map');
+SELECT pgv_map('vars5', 'm1', 'pgv_records.map');
+SELECT pgv_select('vars5', 'm1', 2);
+SELECT pgv_select('vars5', 'm1', 5);
+SELECT * FROM pgv_select('vars5', 'm1') AS (id int, t text) ORDER BY id;
+SELECT * FROM pgv_select('vars5', 'm1', ARRAY[3, 1]) AS (id int, t text);
+SELECT pgv_insert('vars5', 'm1', row(4, 'str4'::text));
+SELECT pgv_map('vars5', 'm1', 'pgv_records.map');
+SELECT pgv_map('vars5', 'm2', 'pgv_missing.map');
+SELECT pgv_exists('vars5', 'm2');
+SELECT pgv_map('vars7', 'm1', 'pgv_missing.map');
+SELECT pgv_exists('vars7');
+SELECT pgv_remove('vars5');
+
+-- Memory limits
+SELECT pgv_set('vars6', 'int1', 101);
+SET pg_variables.max_memory_per_package = '64kB';
+SELECT pgv_load('vars6', 'r1', 'SELECT i, repeat(''x'', 100) FROM generate_series(1, 5000) i');
+SELECT pgv_set('vars6', 'int2', 102);
+SELECT pgv_exists('vars6', 'int2');
+SELECT pgv_insert('vars6', 'r2', row(1, 'str1'::text));
+SELECT pgv_exists('vars6', 'r2');
+RESET pg_variables.max_memory_per_package;
+SELECT pgv_remove('vars6');
+
+-- Cache packages
+SELECT pgv_create_cache('vars6', 1000);
+SELECT pgv_create_cache('vars6', 1000);
+SELECT pgv_insert('vars6', 'r1', row(1, repeat('x', 300)));
+SELECT pgv_insert('vars6', 'r1', row(2, repeat('x', 300)));
+SELECT pgv_select('vars6', 'r1', 1) IS NOT NULL;
+SELECT pgv_insert('vars6', 'r1', row(3, repeat('x', 300)));
+SELECT s.id, length(s.t) FROM pgv_select('vars6', 'r1') AS s(id int, t text) ORDER BY s.id;
+SELECT pgv_insert('vars6', 'r2', row(1, 'str1'::text), true);
+SELECT pgv_remove('vars6');
+
+-- Expiration of values and records
+SELECT pgv_set('vars7', 'int1', 101, false, '100 ms');
+SELECT pgv_set('vars7', 'int2', 102, false, '1 hour');
+SELECT pgv_insert('vars7', 'r1', row(1, 'str1'::text), false, '100 ms');
+SELECT pgv_insert('vars7', 'r1', row(2, 'str2'::text), false, '1 hour');
+SELECT pgv_create_index('vars7', 'r1', 't');
+SELECT pgv_insert('vars7', 'r1', row(3, 'str3'::text), false, '100 ms');
+SELECT pgv_get('vars7', 'int1', NULL::int), pgv_get('vars7', 'int2', NULL::int);
+SELECT pg_sleep(0.2);
+SELECT pgv_get('vars7', 'int1', NULL::int, false), pgv_get('vars7', 'int2', NULL::int);
+SELECT pgv_get('vars7', 'int1', NULL::int);
+SELECT pgv_exists('vars7', 'int1'), pgv_exists('vars7', 'int2');
+SELECT package, name FROM pgv_list() WHERE package = 'vars7' ORDER BY name;
+SELECT * FROM pgv_select('vars7', 'r1') AS (id int, t text);
+SELECT * FROM pgv_select_ordered('vars7', 'r1') AS (id int, t text);
+SELECT * FROM pgv_select_range('vars7', 'r1', 1, 3) AS (id int, t text);
+SELECT * FROM pgv_select_le('vars7', 'r1', 3) AS (id int, t text);
+SELECT * FROM pgv_select_by('vars7', 'r1', 't', 'str3'::text) AS (id int, t text);
+SELECT records FROM pgv_stats_detailed() WHERE package = 'vars7' AND name = 'r1';
+SELECT pgv_select('vars7', 'r1', 1);
+SELECT pgv_select('vars7', 'r1', 2);
+SELECT pgv_insert('vars7', 'r1', row(1, 'str3'::text));
+SELECT * FROM pgv_select('vars7', 'r1') AS (id int, t text) ORDER BY id;
+SELECT pgv_set('vars7', 'int3', 103, false, '-1 hour');
+SELECT pgv_remove('vars7');
+
+-- Detailed statistics of variables
+SELECT pgv_set('vars8', 'int1', 101);
+SELECT pgv_insert('vars8', 'r1', row(1, 'str1'::text));
+SELECT pgv_insert('vars8', 'r1', row(2, 'str2'::text));
+BEGIN;
+SELECT pgv_set('vars8', 'int2', 102, true);
+SAVEPOINT sp1;
+SELECT pgv_set('vars8', 'int2', 103, true);
+SELECT package, name, is_transactional, records, data_size > 0 AS has_data, states
+	FROM pgv_stats_detailed() WHERE package = 'vars8' ORDER BY name;
+COMMIT;
+SELECT pgv_remove('vars8');
+
+-- Profiling of functions
+SET pg_variables.profile = on;
+SELECT pgv_profile_reset();
+SELECT pgv_set('vars9', 'int1', 101);
+SELECT pgv_get('vars9', 'int1', NULL::int);
+SELECT pgv_insert('vars9', 'r1', row(1, 'str1'::text));
+SELECT pgv_select('vars9', 'r1', 1);
+RESET pg_variables.profile;
+SELECT pgv_get('vars9', 'int1', NULL::int);
+SELECT p.name, p.count, (SELECT sum(l) FROM unnest(p.latency) l) AS latency
+	FROM pgv_profile() p WHERE p.name LIKE 'pgv%' ORDER BY p.name;
+SELECT pgv_remove('vars9');
+
+-- Array variables
+SELECT pgv_push('vars10', 'a1', 101);
+SELECT pgv_push('vars10', 'a1', 102);
+SELECT pgv_push('vars10', 'a1', NULL::int);
+SELECT pgv_len('vars10', 'a1');
+SELECT pgv_get_elem('vars10', 'a1', 2, NULL::int);
+SELECT pgv_get_elem('vars10', 'a1', 3, NULL::int);
+SELECT pgv_get_elem('vars10', 'a1', 4, NULL::int);
+SELECT pgv_set_elem('vars10', 'a1', 1, 100);
+SELECT pgv_set_elem('vars10', 'a1', 4, 104);
+SELECT pgv_get_elem('vars10', 'a1', 1, NULL::int);
+SELECT pgv_get_elem('vars10', 'a1', 1, NULL::text);
+SELECT pgv_push('vars10', 't1', 'str' || i) FROM generate_series(1, 3) i;
+SELECT pgv_get_elem('vars10', 't1', i, NULL::text) FROM generate_series(1, 3) i;
+SELECT pgv_set('vars10', 'int1', 101);
+SELECT pgv_len('vars10', 'int1');
+SELECT pgv_restore(pgv_dump('vars10'));
+SELECT pgv_len('vars10', 'a1');
+SELECT pgv_remove('vars10');
+
+-- Values are detoasted when they are set
+CREATE TABLE large_values (t text);
+INSERT INTO large_values SELECT string_agg(md5(i::text), '') FROM generate_series(1, 1000) i;
+SELECT pgv_set('vars11', 'text1', t) FROM large_values;
+SELECT pgv_push('vars11', 'a1', t) FROM large_values;
+DROP TABLE large_values;
+SELECT length(pgv_get('vars11', 'text1', NULL::text));
+SELECT length(pgv_get_elem('vars11', 'a1', 1, NULL::text));
+SELECT pgv_remove('vars11');
+
+-- Counters and conditional updates
+SELECT pgv_incr('vars12', 'c1', 1);
+SELECT pgv_incr('vars12', 'c1', 41);
+SELECT pgv_incr('vars12', 'c2', 10000000000::bigint);
+SELECT pgv_incr('vars12', 'c3', 1.5);
+SELECT pgv_incr('vars12', 'c3', 1.25);
+SELECT pgv_incr('vars12', 'c1', 2147483647);
+SELECT pgv_incr('vars12', 'c1', 1::bigint);
+SELECT pgv_incr('vars12', 't1', 'a'::text);
+SELECT pgv_incr('vars12', 'c1', NULL::int);
+SELECT pgv_cas('vars12', 'c1', 41, 0);
+SELECT pgv_cas('vars12', 'c1', 42, NULL);
+SELECT pgv_incr('vars12', 'c1', 1);
+SELECT pgv_cas('vars12', 'c1', NULL, 1);
+SELECT pgv_get('vars12', 'c1', NULL::int);
+SELECT pgv_cas('vars12', 'c3', 2.750, 0.0);
+SELECT pgv_get('vars12', 'c3', NULL::numeric);
+SELECT pgv_cas('vars12', 'c4', 1, 2);
+SELECT pgv_remove('vars12');
+
+-- Several variables at once
+SELECT pgv_set_many('vars13', ARRAY['v1', 'v2', 'v3'], ARRAY[1, NULL, 3]);
+SELECT pgv_get_many('vars13', ARRAY['v3', 'v2', 'v1'], NULL::int);
+SELECT pgv_get_many('vars13', ARRAY['v1', 'v4'], NULL::int, false);
+SELECT pgv_get_many('vars13', ARRAY['v1', 'v4'], NULL::int);
+SELECT pgv_get_many('vars13', '{}', NULL::int);
+SELECT pgv_get_many('vars14', ARRAY['v1'], NULL::int, false);
+SELECT pgv_get_many('vars13', ARRAY['v1', NULL], NULL::int);
+SELECT pgv_get_many('vars13', ARRAY['v1'], NULL::text);
+SELECT pgv_set_many('vars13', ARRAY['v1', 'v2'], ARRAY[1]);
+SELECT pgv_set_many('vars13', ARRAY['t1', 't2'], ARRAY['a', 'b']);
+SELECT pgv_get('vars13', 't2', NULL::text);
+SELECT pgv_set_many('vars13', ARRAY['iv1'], ARRAY['1 2'::int2vector]);
+SELECT pgv_remove('vars13');
+
+-- Reset of packages
+SELECT pgv_set('vars15', 'v1', 1);
+SELECT pgv_insert('vars15', 'r1', row(1, 'a'::text));
+SELECT pgv_reset('vars15');
+SELECT pgv_exists('vars15');
+SELECT pgv_exists('vars15', 'v1');
+SELECT pgv_set('vars15', 'v1', 2);
+SELECT pgv_get('vars15', 'v1', NULL::int);
+SELECT pgv_reset();
+SELECT * FROM pgv_list() order by package, name;
+SELECT pgv_exists('vars15');
+SELECT pgv_reset('vars16');
+SELECT pgv_remove('vars15');
+
+-- Names which change between calls at the same call site
+SELECT pgv_set('vars16', 'v' || i, i) FROM generate_series(1, 3) i;
+DO $$
+DECLARE
+	vname text;
+	aname text;
+	total int := 0;
+BEGIN
+	FOREACH vname IN ARRAY ARRAY['v1', 'v2', 'v3'] LOOP
+		aname := 'a' || vname;
+		total := total + pgv_get('vars16', vname, NULL::int);
+		PERFORM pgv_incr('vars16', vname, 10);
+		PERFORM pgv_push('vars16', aname, total);
+		PERFORM pgv_set_elem('vars16', aname, 1, pgv_get_elem('vars16', aname, 1, NULL::int) * 2);
+	END LOOP;
+	RAISE NOTICE 'total %', total;
+END
+$$;
+SELECT pgv_get('vars16', 'v' || i, NULL::int) FROM generate_series(1, 3) i;
+SELECT pgv_get_elem('vars16', 'av' || i, 1, NULL::int) FROM generate_series(1, 3) i;
+DO $$
+DECLARE
+	pname text;
+BEGIN
+	FOREACH pname IN ARRAY ARRAY['vars16', 'vars17'] LOOP
+		PERFORM pgv_set(pname, 'p1', pname);
+	END LOOP;
+END
+$$;
+SELECT pgv_get('vars16', 'p1', NULL::text), pgv_get('vars17', 'p1', NULL::text);
+SELECT pgv_remove('vars16');
+SELECT pgv_remove('vars17');
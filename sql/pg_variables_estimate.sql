@@ -0,0 +1,32 @@
+-- Row estimates of pgv_select() follow the variable since PostgreSQL 12,
+-- older servers use the default estimate, see pg_variables_estimate_1.out
+CREATE FUNCTION plan_rows(query text) RETURNS float8 AS $$
+DECLARE
+	plan json;
+BEGIN
+	EXECUTE 'EXPLAIN (COSTS ON, FORMAT JSON) ' || query INTO plan;
+	RETURN plan->0->'Plan'->>'Plan Rows';
+END
+$$ LANGUAGE plpgsql;
+
+SELECT pgv_load('vars', 'r1', 'SELECT i, ''str'' || i FROM generate_series(1, 100) i');
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r1'') AS (id int, t text)');
+SELECT plan_rows('SELECT * FROM pgv_select_ordered(''vars'', ''r1'') AS (id int, t text)');
+SELECT count(*) FROM generate_series(1, 60) i WHERE pgv_delete('vars', 'r1', i);
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r1'') AS (id int, t text)');
+SELECT pgv_insert('vars', 'r1', row(1000, 'str1000'::text), false, '100 ms');
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r1'') AS (id int, t text)');
+SELECT pg_sleep(0.2);
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r1'') AS (id int, t text)');
+
+-- Forms which take an array of keys return at most one record per key
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r1'', ARRAY[61, 62, 63]) AS (id int, t text)');
+SELECT plan_rows('SELECT * FROM pgv_select_ordinality(''vars'', ''r1'', ARRAY[61, 62]) AS (n bigint, id int, t text)');
+SELECT pgv_load('vars', 'r2', 'SELECT i, ''str'' || i FROM generate_series(1, 2) i');
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r2'', ARRAY[1, 2, 3]) AS (id int, t text)');
+
+-- Unknown variables get the default estimate
+SELECT plan_rows('SELECT * FROM pgv_select(''vars'', ''r3'') AS (id int, t text)');
+
+SELECT pgv_remove('vars');
+DROP FUNCTION plan_rows(text);
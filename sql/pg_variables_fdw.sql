@@ -0,0 +1,38 @@
+-- Foreign tables over record variables
+CREATE SERVER pgv_server FOREIGN DATA WRAPPER pg_variables;
+CREATE FOREIGN TABLE pgv_table (id int, t text) SERVER pgv_server
+  OPTIONS (package 'vars_fdw', variable 'r1');
+CREATE FOREIGN TABLE pgv_bad (id int) SERVER pgv_server
+  OPTIONS (package 'vars_fdw');
+SELECT * FROM pgv_table;
+
+SELECT pgv_load('vars_fdw', 'r1', 'SELECT i, ''str'' || i FROM generate_series(1, 1000) i');
+SELECT count(*) FROM pgv_table;
+SELECT * FROM pgv_table WHERE id = 5;
+SELECT * FROM pgv_table WHERE id = 5000;
+EXPLAIN (COSTS OFF) SELECT * FROM pgv_table WHERE id = 5;
+
+-- Lookups by the key of the inner side of nested loops
+EXPLAIN (COSTS OFF)
+SELECT v.column1, t.t FROM (VALUES (3), (7), (2000)) v JOIN pgv_table t ON t.id = v.column1;
+SELECT v.column1, t.t FROM (VALUES (3), (7), (2000)) v JOIN pgv_table t ON t.id = v.column1
+ORDER BY 1;
+
+-- Expired records are not returned
+SELECT pgv_insert('vars_fdw', 'r1', row(1001, 'str1001'::text), false, '100 ms');
+SELECT count(*) FROM pgv_table;
+SELECT pg_sleep(0.2);
+SELECT count(*) FROM pgv_table;
+SELECT * FROM pgv_table WHERE id = 1001;
+
+-- Structure of the table should be the same as structure of the variable
+CREATE FOREIGN TABLE pgv_table2 (id int, t int) SERVER pgv_server
+  OPTIONS (package 'vars_fdw', variable 'r1');
+SELECT * FROM pgv_table2;
+
+-- Records can not be deleted while they are scanned
+SELECT pgv_delete('vars_fdw', 'r1', id) FROM pgv_table;
+
+DROP FOREIGN TABLE pgv_table, pgv_table2;
+DROP SERVER pgv_server;
+SELECT pgv_remove('vars_fdw');
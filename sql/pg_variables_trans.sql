@@ -460,3 +460,199 @@ SELECT pgv_set('vars', 'trans1', 'package restored'::text, true);
 SELECT * FROM pgv_list() ORDER BY package, name;
 COMMIT;
 SELECT pgv_remove('vars');
+
+-- Package removed in released savepoint while its variables were changed at
+-- parent level
+BEGIN;
+SELECT pgv_set('vars', 'trans1', 'before savepoint'::text, true);
+SAVEPOINT sp1;
+SELECT pgv_set('vars', 'trans2', 'in savepoint'::text, true);
+SAVEPOINT sp2;
+SELECT pgv_remove('vars');
+RELEASE sp2;
+SELECT * FROM pgv_list() ORDER BY package, name;
+ROLLBACK TO sp1;
+SELECT * FROM pgv_list() ORDER BY package, name;
+COMMIT;
+SELECT * FROM pgv_list() ORDER BY package, name;
+SELECT pgv_remove('vars');
+
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_set('vars', 'trans1', 'package created'::text, true);
+RELEASE sp1;
+SAVEPOINT sp2;
+SELECT pgv_remove('vars');
+RELEASE sp2;
+SELECT * FROM pgv_list() ORDER BY package, name;
+COMMIT;
+SELECT package FROM pgv_stats();
+
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_set('vars', 'trans1', 'package created'::text, true);
+RELEASE sp1;
+SAVEPOINT sp2;
+SELECT pgv_remove('vars');
+RELEASE sp2;
+ROLLBACK;
+SELECT package FROM pgv_stats();
+
+-- Changes of a level below savepoints which changed nothing
+BEGIN;
+SELECT pgv_set('vars', 'trans1', 'level 1'::text, true);
+SAVEPOINT sp1;
+SAVEPOINT sp2;
+SELECT pgv_set('vars', 'trans1', 'level 3'::text, true);
+RELEASE sp2;
+SAVEPOINT sp3;
+RELEASE sp3;
+SELECT pgv_get('vars', 'trans1', NULL::text);
+ROLLBACK TO sp1;
+SELECT pgv_get('vars', 'trans1', NULL::text);
+COMMIT;
+SELECT pgv_get('vars', 'trans1', NULL::text);
+SELECT pgv_remove('vars');
+
+-- Array variables
+BEGIN;
+SELECT pgv_push('vars', 'a1', 101, true);
+SAVEPOINT sp1;
+SELECT pgv_push('vars', 'a1', 102, true);
+SELECT pgv_set_elem('vars', 'a1', 1, 100);
+SELECT pgv_set_elem('vars', 'a1', 1, 99);
+SAVEPOINT sp2;
+SELECT pgv_set_elem('vars', 'a1', 2, 98);
+SELECT pgv_push('vars', 'a1', 103, true);
+RELEASE sp2;
+SELECT pgv_get_elem('vars', 'a1', i, NULL::int) FROM generate_series(1, 3) i;
+ROLLBACK TO sp1;
+SELECT pgv_len('vars', 'a1');
+COMMIT;
+SELECT pgv_get_elem('vars', 'a1', 1, NULL::int);
+SELECT pgv_remove('vars');
+
+-- Counters
+SELECT pgv_incr('vars', 'c1', 1, true);
+BEGIN;
+SELECT pgv_incr('vars', 'c1', 1, true);
+SAVEPOINT sp1;
+SELECT pgv_incr('vars', 'c1', 1, true);
+SELECT pgv_cas('vars', 'c1', 3, 10);
+ROLLBACK TO sp1;
+SELECT pgv_get('vars', 'c1', NULL::int);
+SELECT pgv_remove('vars', 'c1');
+SELECT pgv_incr('vars', 'c1', 5, true);
+ROLLBACK;
+SELECT pgv_get('vars', 'c1', NULL::int);
+SELECT pgv_set('vars', 'c2', NULL::int, true);
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_incr('vars', 'c2', 1, true);
+SELECT states FROM pgv_stats_detailed() WHERE package = 'vars' AND name = 'c2';
+COMMIT;
+SELECT pgv_get('vars', 'c2', NULL::int);
+SELECT pgv_remove('vars');
+
+-- Several variables at once
+BEGIN;
+SELECT pgv_set_many('vars', ARRAY['m1', 'm2'], ARRAY[1, 2], true);
+SAVEPOINT sp1;
+SELECT pgv_set_many('vars', ARRAY['m1', 'm2'], ARRAY[10, 20], true);
+ROLLBACK TO sp1;
+SELECT pgv_get_many('vars', ARRAY['m1', 'm2'], NULL::int);
+COMMIT;
+SELECT pgv_remove('vars');
+
+-- Reset of packages
+SELECT pgv_set('vars', 'r1', 1);
+SELECT pgv_set('vars', 't1', 1, true);
+BEGIN;
+SELECT pgv_reset('vars');
+SELECT * FROM pgv_list() WHERE package = 'vars' ORDER BY name;
+ROLLBACK;
+SELECT * FROM pgv_list() WHERE package = 'vars' ORDER BY name;
+SELECT pgv_remove('vars');
+
+-- Changes of the same record under nested savepoints
+SELECT pgv_insert('vars', 'r1', row(1, 'str1'::text), true);
+BEGIN;
+SELECT pgv_update('vars', 'r1', row(1, 'str2'::text));
+SAVEPOINT sp1;
+SELECT pgv_update('vars', 'r1', row(1, 'str3'::text));
+SAVEPOINT sp2;
+SELECT pgv_update('vars', 'r1', row(1, 'str4'::text));
+RELEASE sp2;
+SELECT pgv_select('vars', 'r1', 1);
+ROLLBACK TO sp1;
+SELECT pgv_select('vars', 'r1', 1);
+SAVEPOINT sp2;
+SELECT pgv_update('vars', 'r1', row(1, 'str5'::text));
+ROLLBACK TO sp2;
+SELECT pgv_select('vars', 'r1', 1);
+COMMIT;
+SELECT pgv_select('vars', 'r1', 1);
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_delete('vars', 'r1', 1);
+SAVEPOINT sp2;
+SELECT pgv_delete('vars', 'r1', 1);
+RELEASE sp2;
+SELECT pgv_select('vars', 'r1', 1);
+ROLLBACK TO sp1;
+SELECT pgv_select('vars', 'r1', 1);
+SAVEPOINT sp2;
+SELECT pgv_delete('vars', 'r1', 1);
+RELEASE sp2;
+COMMIT;
+SELECT pgv_select('vars', 'r1', 1);
+BEGIN;
+SAVEPOINT sp1;
+SELECT pgv_insert('vars', 'r1', row(1, 'str6'::text), true);
+SAVEPOINT sp2;
+SELECT pgv_delete('vars', 'r1', 1);
+SELECT pgv_insert('vars', 'r1', row(1, 'str7'::text), true);
+ROLLBACK TO sp2;
+SELECT pgv_select('vars', 'r1', 1);
+SAVEPOINT sp3;
+SELECT pgv_delete('vars', 'r1', 1);
+SAVEPOINT sp4;
+SELECT pgv_insert('vars', 'r1', row(1, 'str8'::text), true);
+RELEASE sp4;
+RELEASE sp3;
+SELECT pgv_select('vars', 'r1', 1);
+ROLLBACK TO sp1;
+SELECT pgv_select('vars', 'r1', 1);
+SELECT pgv_insert('vars', 'r1', row(1, 'str9'::text), true);
+COMMIT;
+SELECT * FROM pgv_select('vars', 'r1') AS (id int, t text);
+SELECT pgv_remove('vars');
+
+-- Names cached between calls which are removed and created again
+SELECT pgv_set('vars', 'n1', 1);
+SELECT pgv_get('vars', 'n1', NULL::int);
+SELECT pgv_remove('vars', 'n1');
+SELECT pgv_set('vars', 'n1', 'str1'::text);
+SELECT pgv_get('vars', 'n1', NULL::text);
+SELECT pgv_insert('vars', 'r1', row(1, 'str1'::text));
+SELECT pgv_remove('vars', 'r1');
+SELECT pgv_insert('vars', 'r1', row(1, 2));
+SELECT * FROM pgv_select('vars', 'r1') AS (id int, v int);
+SELECT pgv_remove('vars');
+SELECT pgv_exists('vars', 'n1');
+SELECT pgv_set('vars', 'n1', 2, true);
+SELECT pgv_get('vars', 'n1', NULL::int);
+BEGIN;
+SELECT pgv_set('vars', 'n2', 3, true);
+SELECT pgv_get('vars', 'n2', NULL::int);
+ROLLBACK;
+SELECT pgv_get('vars', 'n2', NULL::int);
+SELECT pgv_set('vars', 'n2', 'str2'::text);
+SELECT pgv_get('vars', 'n2', NULL::text);
+BEGIN;
+SELECT pgv_remove('vars');
+SELECT pgv_exists('vars', 'n1');
+ROLLBACK;
+SELECT pgv_get('vars', 'n1', NULL::int);
+SELECT pgv_exists('vars', 'n2');
+SELECT pgv_remove('vars');